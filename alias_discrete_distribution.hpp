@@ -0,0 +1,154 @@
+#pragma once
+
+// alias_discrete_distribution<IntType> - like discrete_distribution,
+// but sampled with a Walker/Vose alias table in O(1) time per draw,
+// rather than a binary search.  The table is built in O(n).
+//
+//     alias_discrete_distribution<int> d{w0, w1, ...};
+//     int i = d(eng);               // one draw
+//     d.generate(eng, b, e);        // fill [b, e) with draws
+//
+// Each draw consumes exactly one 64-bit value from the engine:  the
+// high 32 bits choose a column (by multiply-and-shift), and the low 32
+// bits are compared with the column's 32-bit threshold to choose
+// between the column and its alias.  Hence the values delivered by
+// generate(eng, b, e) are the same as e-b calls to d(eng), and they
+// depend only on the engine's state.  generate gets its random words
+// from the engine's bulk operator()(b, e), when it has one.
+//
+// The engine must deliver uniformly distributed 64-bit values (e.g.,
+// threefry4x64, philox4x64 or mt19937_64).  The column choice is
+// biased by at most n/2^32 (relative), and the threshold is rounded to
+// 32 bits, so don't use more than a few million weights if that
+// matters.
+
+#include <algorithm>
+#include <array>
+#include <concepts>
+#include <cstdint>
+#include <initializer_list>
+#include <iterator>
+#include <limits>
+#include <numeric>
+#include <random>
+#include <vector>
+
+namespace std{
+
+template <integral IntType = int>
+class alias_discrete_distribution{
+public:
+    using result_type = IntType;
+
+private:
+    // Each column is packed into one 64-bit word so that a draw needs
+    // only one (gathered) load:  the threshold in the low 32 bits and
+    // the alias in the high 32 bits.
+    vector<uint64_t> table;
+    vector<double> probs;
+    // Words are taken from the engine this many at a time by generate.
+    static constexpr size_t chunk = 256;
+
+    void init(){
+        size_t n = probs.size();
+        if(n == 0){
+            probs.push_back(1.);
+            n = 1;
+        }
+        if(n > numeric_limits<uint32_t>::max() || uint64_t(n-1) > uint64_t(numeric_limits<IntType>::max()))
+            throw invalid_argument("alias_discrete_distribution:  too many weights");
+        double sum = accumulate(probs.begin(), probs.end(), 0.);
+        if(!(sum > 0.))
+            throw invalid_argument("alias_discrete_distribution:  the weights must have a positive sum");
+        for(auto& p : probs)
+            p /= sum;
+
+        // Vose's method:  scale the probabilities by n, and repeatedly
+        // top up a 'small' column (< 1) from a 'large' one (>= 1).
+        vector<double> scaled(n);
+        vector<uint32_t> small, large;
+        for(size_t i=0; i<n; ++i){
+            scaled[i] = probs[i] * n;
+            (scaled[i] < 1. ? small : large).push_back(i);
+        }
+        table.assign(n, 0);
+        auto set = [&](uint32_t i, double p, uint32_t alias){
+            // A threshold of 2^32-1 is as close to 'always' as we can get.
+            double t = std::min(p * 0x1p32, double(numeric_limits<uint32_t>::max()));
+            table[i] = uint64_t(alias) << 32 | uint32_t(t);
+        };
+        while(!small.empty() && !large.empty()){
+            uint32_t s = small.back(); small.pop_back();
+            uint32_t l = large.back();
+            set(s, scaled[s], l);
+            scaled[l] -= 1. - scaled[s];
+            if(scaled[l] < 1.){
+                large.pop_back();
+                small.push_back(l);
+            }
+        }
+        // Whatever is left is 1, up to roundoff.  Alias it to itself so
+        // that the roundoff doesn't matter.
+        for(auto v : {&small, &large})
+            for(auto i : *v)
+                set(i, 1., i);
+    }
+
+    result_type lookup(uint64_t word) const{
+        uint32_t idx = (word >> 32) * table.size() >> 32;
+        uint64_t e = table[idx];
+        return uint32_t(word) < uint32_t(e) ? idx : uint32_t(e >> 32);
+    }
+
+    template <typename G>
+    static void check_engine(){
+        static_assert(G::min() == 0 && G::max() == numeric_limits<uint64_t>::max(),
+                      "alias_discrete_distribution needs an engine that delivers 64-bit values");
+    }
+
+public:
+    alias_discrete_distribution() { init(); }
+    template <input_iterator InputIt>
+    alias_discrete_distribution(InputIt first, InputIt last) : probs(first, last) { init(); }
+    alias_discrete_distribution(initializer_list<double> wl) : probs(wl) { init(); }
+
+    void reset() {}
+    vector<double> probabilities() const { return probs; }
+    result_type min() const { return 0; }
+    result_type max() const { return table.size() - 1; }
+
+    template <uniform_random_bit_generator G>
+    result_type operator()(G& g) const{
+        check_engine<G>();
+        return lookup(g());
+    }
+
+    // Fill [out, sen) with draws.
+    template <uniform_random_bit_generator G, output_iterator<const result_type&> O, sized_sentinel_for<O> S>
+    O generate(G& g, O out, S sen) const{
+        check_engine<G>();
+        array<uint64_t, chunk> words;
+        array<result_type, chunk> res;
+        for(auto n = sen - out; n > 0; ){
+            size_t m = std::min<size_t>(chunk, n);
+            if constexpr (requires { g(words.begin(), words.end()); })
+                g(words.begin(), words.begin() + m);
+            else
+                for(size_t j=0; j<m; ++j)
+                    words[j] = g();
+            // Written as a simple loop over arrays so that the compiler
+            // can vectorize it, with gathers from the table.
+            for(size_t j=0; j<m; ++j)
+                res[j] = lookup(words[j]);
+            out = ranges::copy(res.begin(), res.begin() + m, out).out;
+            n -= m;
+        }
+        return out;
+    }
+
+    friend bool operator==(const alias_discrete_distribution& a, const alias_discrete_distribution& b){
+        return a.probs == b.probs;
+    }
+};
+
+} // namespace std
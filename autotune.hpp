@@ -0,0 +1,262 @@
+#pragma once
+
+// Autotuning of the bulk-generation knobs whose best values depend on
+// the host (cache sizes, ISA) rather than on the code:
+//
+//   - which of a prf's kernel variants is fastest.  threefry_prf's
+//     variants are its simd widths:  0 (scalar), 16, 32, ... bytes, up
+//     to PRF_SIMD_SIZE_BYTES.  They all produce the same (ordered)
+//     results.  Prfs without variants just have the one.
+//   - how big counter_based_engine's staging buffer is, i.e., how many
+//     blocks it asks the prf for at a time when the output iterator
+//     isn't contiguous.
+//
+// prf_autotune<prf>(file) times each candidate for a few milliseconds
+// and returns the winners in a prf_tuning.  It remembers them in
+// 'file', so that later runs on the same host just read them back.
+// The entries are keyed by the prf's type and the build's ISA and simd
+// configuration, so one file can serve several programs.  An empty
+// file name means don't cache.
+//
+// With -DPRF_AUTOTUNE=1, threefry_prf::generate and counter_based_engine
+// use prf_tuned<prf>(), which calls prf_autotune the first time it's
+// needed for each prf, caching in the file named by the environment
+// variable PRF_AUTOTUNE_FILE, or by default in
+// $XDG_CACHE_HOME/prf-autotune.<hostname>.txt (or $HOME/.cache/...).
+// Without it (the default), prf_tuned returns the compile-time
+// defaults, and nothing is measured, read or written.  prf_autotune
+// and the code behind it aren't even compiled, so the prfs and
+// engines that include this header don't need POSIX.
+//
+// PRF_AUTOTUNE must have the same value in every translation unit of
+// a program.
+
+#ifndef PRF_AUTOTUNE
+#define PRF_AUTOTUNE 0
+#endif
+
+#include "detail.hpp"
+#include <array>
+#include <cstddef>
+#if PRF_AUTOTUNE
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <deque>
+#include <optional>
+#include <ranges>
+#include <string>
+#include <typeinfo>
+#include <vector>
+#include <unistd.h>
+#endif
+
+namespace std{
+
+struct prf_tuning{
+    size_t kernel_variant;  // the argument for the prf's kernel_variant tag
+    size_t staging_bytes;   // counter_based_engine's staging buffer size
+};
+
+namespace detail{
+
+inline constexpr bool autotuning = PRF_AUTOTUNE;
+inline constexpr size_t default_staging_bytes = 4096;
+inline constexpr array<size_t, 6> staging_bytes_candidates = {1024, 2048, 4096, 8192, 16384, 32768};
+inline constexpr size_t max_staging_bytes = staging_bytes_candidates.back();
+
+template <typename prf>
+constexpr prf_tuning default_tuning(){
+    if constexpr (requires { prf::default_kernel_variant; })
+        return {prf::default_kernel_variant, default_staging_bytes};
+    else
+        return {0, default_staging_bytes};
+}
+
+#if PRF_AUTOTUNE
+inline string autotune_cache_file(){
+    if(const char* f = getenv("PRF_AUTOTUNE_FILE"))
+        return f;
+    string dir;
+    if(const char* x = getenv("XDG_CACHE_HOME"); x && *x)
+        dir = x;
+    else if(const char* h = getenv("HOME"); h && *h)
+        dir = string(h) + "/.cache";
+    else
+        return "";
+    char host[256] = "";
+    gethostname(host, sizeof(host)-1);
+    return dir + "/prf-autotune." + host + ".txt";
+}
+
+template <typename prf>
+string autotune_key(){
+    string key = typeid(prf).name();
+#if defined(__AVX512F__)
+    key += "/avx512";
+#elif defined(__AVX2__)
+    key += "/avx2";
+#elif defined(__AVX__)
+    key += "/avx";
+#elif defined(__SSE2__)
+    key += "/sse2";
+#endif
+    if constexpr (requires { prf::kernel_variants; })
+        for(auto v : prf::kernel_variants){
+            key += '/';
+            key += to_string(v);
+        }
+    return key;
+}
+
+template <typename prf>
+bool autotune_valid(const prf_tuning& t){
+    bool kv = true;
+    if constexpr (requires { prf::kernel_variants; })
+        kv = ranges::find(prf::kernel_variants, t.kernel_variant) != ranges::end(prf::kernel_variants);
+    return kv && ranges::find(staging_bytes_candidates, t.staging_bytes) != staging_bytes_candidates.end();
+}
+
+// The last entry for key in file, if any.
+inline optional<prf_tuning> autotune_read(const string& file, const string& key){
+    FILE* f = fopen(file.c_str(), "r");
+    if(!f)
+        return nullopt;
+    optional<prf_tuning> ret;
+    char k[512];
+    size_t v, s;
+    while(fscanf(f, "%511s %zu %zu", k, &v, &s) == 3)
+        if(key == k)
+            ret = prf_tuning{v, s};
+    fclose(f);
+    return ret;
+}
+
+// One short line, appended with one write, so processes tuning at the
+// same time can't interleave their entries.  Failure isn't an error:
+// we'll just measure again next time.
+inline void autotune_write(const string& file, const string& key, const prf_tuning& t){
+    if(FILE* f = fopen(file.c_str(), "a")){
+        fprintf(f, "%s %zu %zu\n", key.c_str(), t.kernel_variant, t.staging_bytes);
+        fclose(f);
+    }
+}
+
+// Run trial(i) for each of the ncand candidates, repeatedly, for about
+// a millisecond each, in several interleaved rounds (the first is a
+// warm-up).  trial returns how many values it produced.  Return the
+// index of the candidate with the highest rate in its best round,
+// unless it's within the noise (3%) of the preferred (default)
+// candidate's.
+template <typename F>
+size_t autotune_pick(size_t ncand, size_t preferred, F trial){
+    using clk = chrono::steady_clock;
+    vector<double> best(ncand, 0.);
+    for(int round=0; round<4; ++round){
+        for(size_t i=0; i<ncand; ++i){
+            size_t done = 0;
+            auto t0 = clk::now();
+            auto t1 = t0;
+            do{
+                done += trial(i);
+                t1 = clk::now();
+            }while(t1 - t0 < chrono::milliseconds(1));
+            if(round)
+                best[i] = std::max(best[i], done / chrono::duration<double>(t1 - t0).count());
+        }
+    }
+    size_t winner = ranges::max_element(best) - best.begin();
+    return best[winner] > 1.03*best[preferred] ? winner : preferred;
+}
+
+template <typename prf>
+prf_tuning autotune_measure(){
+    using in_type = array<typename prf::input_value_type, prf::input_count>;
+    using out_type = prf::output_value_type;
+    constexpr size_t block_bytes = prf::output_count * sizeof(out_type);
+    constexpr size_t kernel_blocks = 256;
+    constexpr size_t nmax = std::max(kernel_blocks, max_staging_bytes/block_bytes + 1);
+    // The inputs are made on the fly from a counter, the way
+    // counter_based_engine makes them.  That matters:  how fast each
+    // kernel is depends on how it gets its input.
+    in_type in, inn;
+    in.fill(0x5eed);
+    auto inrange = [&](size_t nblocks){
+        return ranges::views::iota(size_t(0), nblocks) |
+               ranges::views::transform([&](size_t ctr){
+                                            inn = in;
+                                            inn[0] = ctr;
+                                            return ranges::begin(inn);
+                                        });
+    };
+    vector<out_type> out(nmax * prf::output_count);
+    prf_tuning ret = default_tuning<prf>();
+    auto gen = [&](size_t variant, size_t nblocks){
+        if constexpr (requires { prf::kernel_variants; })
+            prf{}.generate(kernel_variant{variant}, inrange(nblocks), out.data());
+        else
+            prf{}.generate(inrange(nblocks), out.data());
+        // Don't let the compiler decide that out is never read.
+        asm volatile("" : : "r"(out.data()) : "memory");
+    };
+
+    if constexpr (requires { prf::kernel_variants; }){
+        constexpr auto& kv = prf::kernel_variants;
+        size_t preferred = ranges::find(kv, ret.kernel_variant) - ranges::begin(kv);
+        ret.kernel_variant = kv[autotune_pick(kv.size(), preferred, [&](size_t i){
+                                                  gen(kv[i], kernel_blocks);
+                                                  return kernel_blocks * prf::output_count;
+                                              })];
+    }
+
+    // As in counter_based_engine's staging path:  generate a buffer
+    // full, then copy it to a non-contiguous destination.
+    deque<out_type> dest(1<<16);
+    auto& sc = staging_bytes_candidates;
+    size_t preferred = ranges::find(sc, ret.staging_bytes) - sc.begin();
+    ret.staging_bytes = sc[autotune_pick(sc.size(), preferred, [&](size_t i){
+                                             size_t nb = std::max<size_t>(1, sc[i]/block_bytes);
+                                             size_t nv = nb * prf::output_count;
+                                             size_t done = 0;
+                                             for(auto d = dest.begin(); dest.end() - d >= ptrdiff_t(nv); d += nv){
+                                                 gen(ret.kernel_variant, nb);
+                                                 ranges::copy(out.begin(), out.begin() + nv, d);
+                                                 done += nv;
+                                             }
+                                             return done;
+                                         })];
+    return ret;
+}
+#endif // PRF_AUTOTUNE
+
+} // namespace detail
+
+#if PRF_AUTOTUNE
+// Measure (or read from 'file') the best prf_tuning for prf on this host.
+template <typename prf>
+prf_tuning prf_autotune(const string& file = detail::autotune_cache_file()){
+    string key = detail::autotune_key<prf>();
+    if(!file.empty())
+        if(auto t = detail::autotune_read(file, key); t && detail::autotune_valid<prf>(*t))
+            return *t;
+    prf_tuning t = detail::autotune_measure<prf>();
+    if(!file.empty())
+        detail::autotune_write(file, key, t);
+    return t;
+}
+#endif // PRF_AUTOTUNE
+
+// The tuning that the library uses for prf:  autotuned once per
+// process with PRF_AUTOTUNE, the compile-time default otherwise.
+template <typename prf>
+const prf_tuning& prf_tuned(){
+#if PRF_AUTOTUNE
+    static const prf_tuning t = prf_autotune<prf>();
+#else
+    static constexpr prf_tuning t = detail::default_tuning<prf>();
+#endif
+    return t;
+}
+
+} // namespace std
@@ -1,7 +1,9 @@
 #include "threefry_prf.hpp"
 #include "philox_prf.hpp"
 #include "siphash_prf.hpp"
+#include "squares_prf.hpp"
 #include "counter_based_engine.hpp"
+#include "compact_counter_based_engine.hpp"
 #include "timeit.hpp"
 #include <iostream>
 #include <iomanip>
@@ -10,6 +12,16 @@
 #include <map>
 #include <functional>
 #include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <vector>
+#include <cmath>
+#include <random>
+#include <numbers>
+#include <thread>
+#include <cerrno>
+#include <cstring>
+#include <sched.h>
 
 using namespace std;
 volatile int check = 0;
@@ -21,6 +33,24 @@ std::ostream& operator<<(std::ostream& os, const array<T, N>& a){
     return os;
 }
 
+// Hardware counters for the full benchmark.  See timeit.hpp.
+hw_counters hw;
+
+// Append what the hardware counters saw to a line of output.
+void print_hw(const timeit_result& perf, double bytes_per_iter){
+    const auto& h = perf.hw;
+    double bytes = perf.count * bytes_per_iter;
+    if(h.cycles > 0)
+        cout << ", " << h.cycles/bytes << (h.cycles_from_tsc ? " ref-cycles/byte (rdtsc)" : " cycles/byte");
+    if(h.instructions >= 0)
+        cout << ", IPC " << h.ipc();
+    if(h.cache_misses >= 0)
+        cout << ", " << h.cache_misses*1024./bytes << " cache misses/KB";
+    if(h.vector_events >= 0)
+        cout << ", " << h.vector_events/bytes << " vector events/byte";
+    cout << "\n";
+}
+
 template<typename PRF>
 void doit(string name){
     static constexpr size_t prf_output_count = PRF::output_count;
@@ -41,11 +71,12 @@ void doit(string name){
                            PRF{}(begin(c), begin(rv));
                            c[0]++;
                            rprf = accumulate(begin(rv), end(rv), rprf, bit_xor<decltype(rprf)>{});
-                       });
+                       }, hw);
     cout << "calling " << name << " directly (" << prf_output_count << " at a time): " << (rprf==0?" (zero?!) ":"");
     cout << perf.iter_per_sec()/1e6 << " Miters/sec";
     Gbytes_per_iter = 1.e-9 * (PRF::output_word_size*prf_output_count)/bits_per_byte;
-    cout << " approx " << perf.iter_per_sec() *  Gbytes_per_iter <<  " GB/s\n";
+    cout << " approx " << perf.iter_per_sec() *  Gbytes_per_iter <<  " GB/s";
+    print_hw(perf, Gbytes_per_iter*1e9);
 
     // bulk generation directly with prf
     // prf_t::generate is a  bit tricky to call.  Is that a problem?
@@ -69,11 +100,12 @@ void doit(string name){
                       PRF{}.generate(range_of_ptrs_into_bulkin,
                                      begin(bulkout));
                       rprf = accumulate(begin(bulkout), end(bulkout), rprf, bit_xor<decltype(rprf)>{});
-                  });
+                  }, hw);
     cout << "calling " << name << " directly (" << bulkN << " at a time): " << (rprf==0?" (zero?!) ":"");
     cout << perf.iter_per_sec()/1e6 << " Miters/sec";
     Gbytes_per_iter = 1.e-9*(bulkN*PRF::output_word_size)/bits_per_byte;
-    cout << " approx " << perf.iter_per_sec() *  Gbytes_per_iter <<  " GB/s\n";
+    cout << " approx " << perf.iter_per_sec() *  Gbytes_per_iter <<  " GB/s";
+    print_hw(perf, Gbytes_per_iter*1e9);
 
     using engine_type = counter_based_engine<PRF, 64/PRF::input_word_size>;
     using engine_result_type = engine_type::result_type;
@@ -83,22 +115,527 @@ void doit(string name){
     perf = timeit(chrono::seconds(5),
                            [&](){
                                r ^= engine();
-                           });
+                           }, hw);
     cout << "calling " << name << " through engine (1 at a time): " << (r==0?" (zero?!) ":"");
     cout << perf.iter_per_sec()/1e6 << " Miters/sec";
     Gbytes_per_iter = 1.e-9 * engine_word_size/bits_per_byte;
-    cout << " approx " << perf.iter_per_sec() * Gbytes_per_iter <<  " GB/s\n";
+    cout << " approx " << perf.iter_per_sec() * Gbytes_per_iter <<  " GB/s";
+    print_hw(perf, Gbytes_per_iter*1e9);
 
     perf = timeit(chrono::seconds(5),
                            [&](){
                                array<engine_result_type, bulkN> bulk;
                                engine(begin(bulk), end(bulk));
                                r = accumulate(begin(bulk), end(bulk), r, bit_xor<engine_result_type>{});
-                           });
+                           }, hw);
     cout << "calling " << name << " through engine (" << bulkN << " at a  time): " << (r==0?" (zero?!) ":"");
     cout << perf.iter_per_sec()/1e6 << " Miters/sec";
     Gbytes_per_iter = 1.e-9 * bulkN*engine_word_size/bits_per_byte;
-    cout << " approx " << perf.iter_per_sec() * Gbytes_per_iter <<  " GB/s\n";
+    cout << " approx " << perf.iter_per_sec() * Gbytes_per_iter <<  " GB/s";
+    print_hw(perf, Gbytes_per_iter*1e9);
+
+    perf = timeit(chrono::seconds(5),
+                           [&](){
+                               array<engine_result_type, bulkN> bulk;
+                               engine.fill_unordered(begin(bulk), end(bulk));
+                               r = accumulate(begin(bulk), end(bulk), r, bit_xor<engine_result_type>{});
+                           }, hw);
+    cout << "calling " << name << " through engine (" << bulkN << " at a  time, unordered): " << (r==0?" (zero?!) ":"");
+    cout << perf.iter_per_sec()/1e6 << " Miters/sec";
+    cout << " approx " << perf.iter_per_sec() * Gbytes_per_iter <<  " GB/s";
+    print_hw(perf, Gbytes_per_iter*1e9);
+
+    // The same reduction, fused with the prf:  no output array.
+    perf = timeit(chrono::seconds(5),
+                           [&](){
+                               engine.for_each_block(bulkN, [&](span<const engine_result_type> s){
+                                                                for(auto v : s)
+                                                                    r ^= v;
+                                                            });
+                           }, hw);
+    cout << "calling " << name << " through engine (" << bulkN << " at a  time, for_each_block): " << (r==0?" (zero?!) ":"");
+    cout << perf.iter_per_sec()/1e6 << " Miters/sec";
+    cout << " approx " << perf.iter_per_sec() * Gbytes_per_iter <<  " GB/s";
+    print_hw(perf, Gbytes_per_iter*1e9);
+}
+
+// The regression gate ('make benchmark-check'):  a short, fixed
+// subset of the measurements above - bulk generate, and the engine
+// one at a time and in bulk - for every prf.  Each is run
+// gate_reps times for gate_dur (after one discarded warm-up run), and
+// we keep the median and the relative interquartile spread of the
+// GB/s figures.
+struct gate_result{
+    double median;
+    double noise;
+};
+using gate_results = map<string, gate_result>; // keyed by "prf measurement"
+static const int gate_reps = 8;
+static const auto gate_dur = chrono::milliseconds(100);
+// The noise allowance is capped, so that a noisy host can't raise
+// the threshold to the point where nothing fails.
+static const double gate_max_noise_threshold = 0.25;
+
+// The gate's measurements are single-threaded.  Pin them to the CPU
+// we're running on (which 'taskset -c N' chooses), so that the
+// scheduler doesn't move them, and their caches, mid-measurement.
+void gate_pin(){
+    int cpu = sched_getcpu();
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    if(cpu >= 0)
+        CPU_SET(cpu, &set);
+    if(cpu < 0 || sched_setaffinity(0, sizeof(set), &set))
+        cerr << "bench: can't pin to a cpu (" << strerror(errno) << "), measuring unpinned\n";
+}
+
+template <typename F>
+gate_result gate_measure(size_t bytes_per_iter, F f){
+    vector<double> gbps;
+    timeit(gate_dur, f);
+    for(int i=0; i<gate_reps; ++i)
+        gbps.push_back(timeit(gate_dur, f).iter_per_sec() * 1.e-9 * bytes_per_iter);
+    ranges::sort(gbps);
+    double med = gbps[gate_reps/2];
+    return {med, (gbps[3*gate_reps/4] - gbps[gate_reps/4])/med};
+}
+
+template<typename PRF>
+void gate(string name, gate_results& results){
+    static const size_t bulkN = 1024;
+    static constexpr size_t Nprf = bulkN/PRF::output_count;
+    static constexpr size_t bytes_per_value = PRF::output_word_size/8;
+    using out_t = PRF::output_value_type;
+    out_t rprf = 0;
+
+    typename PRF::input_value_type bulkin[Nprf*PRF::input_count];
+    for(size_t i=0; auto& v : bulkin)
+        v = i++;
+    auto inrange = views::iota(size_t(0), Nprf) |
+                   views::transform([&bulkin](auto i){
+                                        auto p = &bulkin[0] + i*PRF::input_count;
+                                        *p += 1;
+                                        return p;
+                                    });
+    results[name + " generate"] = gate_measure(bulkN*bytes_per_value, [&](){
+            out_t bulkout[bulkN];
+            PRF{}.generate(inrange, begin(bulkout));
+            rprf = accumulate(begin(bulkout), end(bulkout), rprf, bit_xor<out_t>{});
+        });
+
+    using engine_type = counter_based_engine<PRF, 64/PRF::input_word_size>;
+    using engine_result_type = engine_type::result_type;
+    engine_type engine;
+    engine_result_type r = 0;
+    results[name + " engine1"] = gate_measure(bytes_per_value, [&](){
+            r ^= engine();
+        });
+    results[name + " engine" + to_string(bulkN)] = gate_measure(bulkN*bytes_per_value, [&](){
+            array<engine_result_type, bulkN> bulk;
+            engine(begin(bulk), end(bulk));
+            r = accumulate(begin(bulk), end(bulk), r, bit_xor<engine_result_type>{});
+        });
+    if(rprf == 0 || r == 0)
+        cout << name << " (zero?!)\n";
+}
+
+// The comparison ('bench --compare'):  std:: engines and ours, all
+// through the same harness.  Every column is ns per value (lower is
+// better), except 'construct' (ns per construction, including the
+// first draw, since our engines don't do any work until then) and
+// 'bytes' (sizeof the engine).  'bulk' fills 1024 values with
+// operator()(b, e) if the engine has one, and with a loop otherwise.
+static const auto compare_dur = chrono::milliseconds(500);
+
+template <typename F>
+double ns_per(size_t values_per_iter, F f){
+    return timeit(compare_dur, f).sec_per_iter() * 1e9 / values_per_iter;
+}
+
+template <typename Engine>
+void compare(const string& name){
+    using result_type = Engine::result_type;
+    Engine eng;
+    result_type r = 0;
+    double raw = ns_per(1, [&](){ r ^= eng(); });
+
+    static const size_t bulkN = 1024;
+    double bulk = ns_per(bulkN, [&](){
+            array<result_type, bulkN> a;
+            if constexpr (requires { eng(a.begin(), a.end()); })
+                eng(a.begin(), a.end());
+            else
+                for(auto& v : a)
+                    v = eng();
+            r = accumulate(a.begin(), a.end(), r, bit_xor<result_type>{});
+        });
+
+    double dsum = 0.;
+    uniform_real_distribution<double> ureal;
+    double ur = ns_per(1, [&](){ dsum += ureal(eng); });
+    normal_distribution<double> normal;
+    double nr = ns_per(1, [&](){ dsum += normal(eng); });
+    long isum = 0;
+    uniform_int_distribution<int> uidist(0, 999);
+    double ui = ns_per(1, [&](){ isum += uidist(eng); });
+
+    result_type s = 1;
+    double construct = ns_per(1, [&](){
+            Engine e(s++);
+            r ^= e();
+        });
+
+    if(r == 0 || dsum == 0. || isum == 0)
+        cout << name << " (zero?!)\n";
+    cout << setw(22) << left << name << right << fixed << setprecision(2)
+         << setw(10) << raw << setw(10) << bulk
+         << setw(10) << ur << setw(10) << nr << setw(10) << ui
+         << setw(11) << construct << setw(8) << sizeof(Engine) << "\n";
+    cout.unsetf(ios::fixed);
+}
+
+void compare_all(){
+    cout << setw(22) << left << "engine" << right
+         << setw(10) << "raw" << setw(10) << "bulk"
+         << setw(10) << "ureal" << setw(10) << "normal" << setw(10) << "uint"
+         << setw(11) << "construct" << setw(8) << "bytes" << "\n";
+    compare<mt19937_64>("mt19937_64");
+    compare<mt19937>("mt19937");
+    compare<minstd_rand>("minstd_rand");
+    compare<ranlux48>("ranlux48");
+    compare<philox4x64>("philox4x64");
+    compare<philox4x32>("philox4x32");
+    compare<threefry4x64>("threefry4x64");
+    compare<threefry2x32>("threefry2x32");
+    compare<squares64>("squares64");
+    compare<squares32>("squares32");
+    compare<compact_philox4x64>("compact_philox4x64");
+    compare<compact_threefry4x64>("compact_threefry4x64");
+}
+
+// The application kernels ('bench --apps'):  small but complete Monte
+// Carlo computations, to show where the engine's speed matters once
+// there's real arithmetic around it.
+//
+//   pi         - the fraction of uniform points in the unit square
+//                that fall in the quarter circle.  A sample is a point.
+//   option     - a European call under Black-Scholes (S=K=100, r=5%,
+//                sigma=20%, T=1), from one normal per path.  A sample is
+//                a path.  The exact price is 10.4506.
+//   walk       - particles taking 2d lattice random walks.  A sample is
+//                a step.  The estimate is the mean squared
+//                displacement, which should be the number of steps.
+//   bootstrap  - the bootstrap standard error of the mean of a fixed
+//                data set.  A sample is one index drawn for a
+//                resample.
+//
+// The work is divided into items (batches of points or paths, a
+// particle, a resample), and the items into contiguous ranges, one
+// per thread.  Each kernel is run in three forms:
+//
+//   scalar  - one engine per thread, one value at a time, through the
+//             std:: distributions.
+//   bulk    - one engine per thread, values 1024 at a time, from
+//             operator()(b, e), converted to uniforms, normals or
+//             indices in separate loops.
+//   streams - one engine per item, keyed by the item's index, used in
+//             bulk.  The results don't depend on the number of
+//             threads, but each item pays for a key and a fresh block.
+//
+// Each line of output is one measurement:  the engine, kernel, form
+// and number of threads, ns per sample, the speedup over the first
+// number of threads with the same form, and the estimate.
+static const auto app_dur = chrono::milliseconds(300);
+static const uint64_t app_seed = 2024;
+enum class app_form{ scalar, bulk, streams };
+
+// 53-bit uniforms in [0, 1) and (0, 1].
+inline double app_u01(uint64_t v){ return (v >> 11) * 0x1p-53; }
+inline double app_u01_open(uint64_t v){ return ((v >> 11) + 1) * 0x1p-53; }
+
+// The sum over items [0, nitems) of item(eng, i), divided into
+// nthreads slices, on nthreads threads, with the engine for each item
+// chosen by form.  Slice t's engine is keyed by t, whichever thread
+// runs it.
+template <typename Eng, typename F>
+double app_run(app_form form, unsigned nthreads, size_t nitems, F item){
+    vector<double> partial(nthreads);
+    detail::parallel_for(nthreads, nthreads, [&](size_t t, unsigned){
+        Eng eng({app_seed, uint64_t(t)});
+        double s = 0.;
+        for(size_t i = nitems*t/nthreads; i < nitems*(t+1)/nthreads; ++i){
+            if(form == app_form::streams)
+                eng.seed({app_seed, uint64_t(i)});
+            s += item(eng, i);
+        }
+        partial[t] = s;
+    });
+    return accumulate(partial.begin(), partial.end(), 0.);
+}
+
+// Fill u[0, n) with uniforms in [0, 1), or normals, from eng's bulk
+// operator().
+template <typename Eng>
+void app_uniforms(Eng& eng, double* u, size_t n){
+    array<uint64_t, 1024> buf;
+    for(size_t k=0; k<n; k+=buf.size()){
+        size_t m = std::min(buf.size(), n - k);
+        eng(buf.begin(), buf.begin() + m);
+        for(size_t j=0; j<m; ++j)
+            u[k+j] = app_u01(buf[j]);
+    }
+}
+template <typename Eng>
+void app_normals(Eng& eng, double* z, size_t n){
+    array<uint64_t, 1024> buf;
+    for(size_t k=0; k<n; k+=buf.size()){
+        size_t m = std::min(buf.size(), n - k);
+        eng(buf.begin(), buf.begin() + (m + 1)/2*2);
+        // Box-Muller, two normals from two values.
+        for(size_t j=0; j<m; j+=2){
+            double r = sqrt(-2.*log(app_u01_open(buf[j])));
+            double th = 2.*numbers::pi*app_u01(buf[j+1]);
+            z[k+j] = r*cos(th);
+            if(j+1 < m)
+                z[k+j+1] = r*sin(th);
+        }
+    }
+}
+
+struct app_kernel{
+    string name;
+    size_t samples;   // per run
+    // The estimate, from nthreads threads.
+    function<double(app_form, unsigned)> run;
+};
+
+template <typename Eng>
+vector<app_kernel> app_kernels(){
+    vector<app_kernel> ret;
+
+    static const size_t pi_batch = 1<<14, pi_items = 256;
+    ret.push_back({"pi", pi_batch*pi_items, [](app_form form, unsigned nthreads){
+        double hits = app_run<Eng>(form, nthreads, pi_items, [form](Eng& eng, size_t){
+            size_t h = 0;
+            if(form == app_form::scalar){
+                uniform_real_distribution<double> u;
+                for(size_t k=0; k<pi_batch; ++k){
+                    double x = u(eng), y = u(eng);
+                    h += x*x + y*y < 1.;
+                }
+            }else{
+                array<double, 2048> u;
+                for(size_t k=0; k<pi_batch; k+=u.size()/2){
+                    app_uniforms(eng, u.data(), u.size());
+                    for(size_t j=0; j<u.size(); j+=2)
+                        h += u[j]*u[j] + u[j+1]*u[j+1] < 1.;
+                }
+            }
+            return double(h);
+        });
+        return 4.*hits/(pi_batch*pi_items);
+    }});
+
+    static const size_t opt_batch = 1<<12, opt_items = 256;
+    static const double S = 100., K = 100., r = 0.05, sigma = 0.2, T = 1.;
+    ret.push_back({"option", opt_batch*opt_items, [](app_form form, unsigned nthreads){
+        const double drift = log(S) + (r - sigma*sigma/2)*T;
+        const double vol = sigma*sqrt(T);
+        double payoff = app_run<Eng>(form, nthreads, opt_items, [=](Eng& eng, size_t){
+            double sum = 0.;
+            if(form == app_form::scalar){
+                normal_distribution<double> normal;
+                for(size_t k=0; k<opt_batch; ++k)
+                    sum += std::max(exp(drift + vol*normal(eng)) - K, 0.);
+            }else{
+                array<double, 1024> z;
+                for(size_t k=0; k<opt_batch; k+=z.size()){
+                    app_normals(eng, z.data(), z.size());
+                    for(double zz : z)
+                        sum += std::max(exp(drift + vol*zz) - K, 0.);
+                }
+            }
+            return sum;
+        });
+        return exp(-r*T)*payoff/(opt_batch*opt_items);
+    }});
+
+    static const size_t walk_steps = 1024, walk_particles = 4096;
+    ret.push_back({"walk", walk_steps*walk_particles, [](app_form form, unsigned nthreads){
+        double msd = app_run<Eng>(form, nthreads, walk_particles, [form](Eng& eng, size_t){
+            long x = 0, y = 0;
+            if(form == app_form::scalar){
+                uniform_int_distribution<int> dir(0, 3);
+                for(size_t s=0; s<walk_steps; ++s){
+                    int d = dir(eng);
+                    x += (d == 0) - (d == 1);
+                    y += (d == 2) - (d == 3);
+                }
+            }else{
+                // 32 two-bit steps per value.
+                array<uint64_t, walk_steps/32> buf;
+                eng(buf.begin(), buf.end());
+                for(uint64_t w : buf)
+                    for(int b=0; b<64; b+=2){
+                        int d = (w >> b) & 3;
+                        x += (d == 0) - (d == 1);
+                        y += (d == 2) - (d == 3);
+                    }
+            }
+            return double(x*x + y*y);
+        });
+        return msd/walk_particles;
+    }});
+
+    // The data:  n fixed normals, from a key that no thread or item
+    // uses, so that the resampling is independent of them.
+    static const size_t boot_n = 1024, boot_items = 1024;
+    static const vector<double> data = [](){
+        vector<double> d(boot_n);
+        Eng eng({app_seed, ~uint64_t(0)});
+        app_normals(eng, d.data(), d.size());
+        return d;
+    }();
+    static const double data_mean = accumulate(data.begin(), data.end(), 0.)/boot_n;
+    ret.push_back({"bootstrap", boot_n*boot_items, [](app_form form, unsigned nthreads){
+        double ss = app_run<Eng>(form, nthreads, boot_items, [form](Eng& eng, size_t){
+            double sum = 0.;
+            if(form == app_form::scalar){
+                uniform_int_distribution<size_t> idx(0, boot_n - 1);
+                for(size_t k=0; k<boot_n; ++k)
+                    sum += data[idx(eng)];
+            }else{
+                // Four 10-bit indices per value.
+                static_assert(boot_n == 1024);
+                array<uint64_t, boot_n/4> buf;
+                eng(buf.begin(), buf.end());
+                for(uint64_t w : buf)
+                    for(int b=0; b<64; b+=16)
+                        sum += data[(w >> b) & (boot_n - 1)];
+            }
+            double dm = sum/boot_n - data_mean;
+            return dm*dm;
+        });
+        return sqrt(ss/boot_items);
+    }});
+    return ret;
+}
+
+template <typename Eng>
+void apps(const string& engname, const vector<unsigned>& threads){
+    static const pair<app_form, const char*> forms[] = {
+        {app_form::scalar, "scalar"}, {app_form::bulk, "bulk"}, {app_form::streams, "streams"}};
+    for(auto& k : app_kernels<Eng>()){
+        for(auto [form, formname] : forms){
+            double ns1 = 0.;
+            for(unsigned nt : threads){
+                double est = 0.;
+                double ns = timeit(app_dur, [&](){ est = k.run(form, nt); }).sec_per_iter()*1e9/k.samples;
+                if(ns1 == 0.)
+                    ns1 = ns;
+                cout << engname << " " << k.name << " " << formname << " " << nt << " "
+                     << ns << " " << ns1/ns << " " << setprecision(6) << est << setprecision(3) << "\n";
+            }
+        }
+    }
+}
+
+void apps_all(vector<unsigned> threads){
+    if(threads.empty()){
+        unsigned hc = std::max(1u, thread::hardware_concurrency());
+        for(unsigned t=1; t<hc; t*=2)
+            threads.push_back(t);
+        threads.push_back(hc);
+    }
+    auto oldprec = cout.precision(3);
+    cout << "# engine kernel form threads ns/sample speedup estimate\n";
+    apps<threefry4x64>("threefry4x64", threads);
+    apps<philox4x64>("philox4x64", threads);
+    cout.precision(oldprec);
+}
+
+// The latency histograms ('bench --latency'):  time individual
+// one-at-a-time draws with rdtsc, and report percentiles of the
+// per-draw cost in reference cycles.  Most draws from a
+// counter_based_engine just copy a saved value, but every
+// output_count'th one calls the prf.  Buffering in the caller (refill
+// a local array with a bulk call when it's empty) trades a rarer,
+// bigger stall for cheaper typical draws.  The overhead of the
+// timestamps themselves (measured with an empty draw) is subtracted.
+static inline unsigned long long fenced_tsc(){
+#if defined(__x86_64__) || defined(__i386__)
+    _mm_lfence();
+    auto ret = __rdtsc();
+    _mm_lfence();
+    return ret;
+#else
+    return clk_t::now().time_since_epoch().count();
+#endif
+}
+
+static const size_t latency_samples = 1'000'000;
+
+template <typename F>
+vector<long long> latency_samples_of(F draw){
+    vector<long long> ret(latency_samples);
+    for(size_t i=0; i<latency_samples/10; ++i)   // warm up
+        draw();
+    for(auto& v : ret){
+        auto t0 = fenced_tsc();
+        draw();
+        v = fenced_tsc() - t0;
+    }
+    ranges::sort(ret);
+    return ret;
+}
+
+template <typename F>
+void latency(const string& label, F draw){
+    static const long long overhead = latency_samples_of([](){})[latency_samples/2];
+    auto v = latency_samples_of(draw);
+    auto pct = [&](double p){ return std::max(0LL, v[size_t(p*(v.size()-1))] - overhead); };
+    cout << setw(44) << left << label << right
+         << setw(8) << pct(0.5) << setw(8) << pct(0.99) << setw(8) << pct(0.999)
+         << setw(10) << std::max(0LL, v.back() - overhead) << "\n";
+}
+
+// A caller-side buffer of B values, refilled by a bulk call.
+template <typename Engine, size_t B>
+struct buffered{
+    Engine eng;
+    array<typename Engine::result_type, B> buf;
+    size_t idx = B;
+    auto operator()(){
+        if(idx == B){
+            eng(buf.begin(), buf.end());
+            idx = 0;
+        }
+        return buf[idx++];
+    }
+};
+
+template <typename PRF>
+void latencies(string name){
+    using engine_type = counter_based_engine<PRF, 64/PRF::input_word_size>;
+    using compact_type = compact_counter_based_engine<PRF, 64/PRF::input_word_size>;
+    typename engine_type::result_type r = 0;
+    // Different seeds, so that r doesn't cancel out.
+    engine_type eng(1);
+    latency(name + " engine", [&](){ r ^= eng(); });
+    compact_type ceng(2);
+    latency(name + " compact engine", [&](){ r ^= ceng(); });
+    buffered<engine_type, 64> b64{engine_type(3)};
+    latency(name + " engine, 64-value buffer", [&](){ r ^= b64(); });
+    buffered<engine_type, 1024> b1024{engine_type(4)};
+    latency(name + " engine, 1024-value buffer", [&](){ r ^= b1024(); });
+    if(r == 0)
+        cout << name << " (zero?!)\n";
+}
+
+void latency_header(){
+    cout << "ref-cycles per draw (rdtsc), " << latency_samples << " samples each\n";
+    cout << setw(44) << left << "" << right
+         << setw(8) << "p50" << setw(8) << "p99" << setw(8) << "p99.9" << setw(10) << "max" << "\n";
 }
 
 // a minimal prf that copies inputs to outputs - useful for estimating
@@ -117,38 +654,180 @@ public:
     }
 };        
 
-#define MAPPED(prf) {string(#prf), function<void(string)>(&doit<prf>)}
+#define MAPPED(prf) {string(#prf), {&doit<prf>, &gate<prf>, &latencies<prf>}}
 #define _ ,
-map<string, function<void(string)>> dispatch_map = {
+struct dispatch_entry{
+    function<void(string)> doit;
+    function<void(string, gate_results&)> gate;
+    function<void(string)> latencies;
+};
+map<string, dispatch_entry> dispatch_map = {
                                                     //    MAPPED(uint64_t, null_prf),
     MAPPED(threefry4x64_prf),
     MAPPED(threefry2x64_prf),
     MAPPED(threefry4x32_prf),
     MAPPED(threefry2x32_prf),
+    MAPPED(threefry8x64_prf),
+    MAPPED(threefry16x64_prf),
 
     MAPPED(philox4x64_prf),
     MAPPED(philox2x64_prf),
     MAPPED(philox4x32_prf),
     MAPPED(philox2x32_prf),
 
+    MAPPED(squares32_prf),
+    MAPPED(squares64_prf),
+
     MAPPED(siphash_prf<4>),
     MAPPED(siphash_prf<16>),
 };
     
 
+void write_gate_results(ostream& os, const gate_results& results){
+    auto oldprec = os.precision(4);
+    os << "# prf measurement median_GB/s relative_noise\n";
+    for(auto& [key, g] : results)
+        os << key << " " << g.median << " " << g.noise << "\n";
+    os.precision(oldprec);
+}
+
+gate_results read_gate_results(istream& is){
+    gate_results ret;
+    string line;
+    while(getline(is, line)){
+        if(line.empty() || line[0] == '#')
+            continue;
+        istringstream iss(line);
+        string prf, measurement;
+        gate_result g;
+        if(iss >> prf >> measurement >> g.median >> g.noise)
+            ret[prf + " " + measurement] = g;
+    }
+    return ret;
+}
+
+// Compare against the baseline.  A measurement fails if its median
+// drops by more than the larger of 'tolerance' and three times the
+// combined noise of the baseline and the current run (capped at
+// gate_max_noise_threshold).  Failures are re-measured once before
+// they count, so that a single burst of interference from elsewhere
+// on the machine doesn't fail the gate.
+int gate_check(const string& baseline_file, double tolerance, const vector<string>& names){
+    ifstream ifs(baseline_file);
+    if(!ifs){
+        cerr << "bench: can't read baseline " << baseline_file << ".  Run 'make benchmark-baseline' first.\n";
+        return 2;
+    }
+    auto baseline = read_gate_results(ifs);
+    auto threshold = [&](const string& key, const gate_result& cur){
+        return std::max(tolerance, std::min(gate_max_noise_threshold, 3*(baseline.at(key).noise + cur.noise)));
+    };
+    auto regressed = [&](const string& key, const gate_result& cur){
+        return cur.median < baseline.at(key).median * (1. - threshold(key, cur));
+    };
+    int nfail = 0;
+    for(auto& name : names){
+        gate_results current;
+        dispatch_map.at(name).gate(name, current);
+        bool retried = false;
+        for(auto& [key, cur] : current){
+            if(!baseline.contains(key)){
+                cout << "NEW      " << key << " " << cur.median << " GB/s (not in baseline)\n";
+                continue;
+            }
+            if(regressed(key, cur) && !retried){
+                // re-measure the whole prf once.
+                gate_results again;
+                dispatch_map.at(name).gate(name, again);
+                for(auto& [k, v] : again)
+                    if(v.median > current[k].median)
+                        current[k] = v;
+                retried = true;
+            }
+            auto& base = baseline.at(key);
+            bool bad = regressed(key, cur);
+            nfail += bad;
+            cout << (bad ? "REGRESSED " : "ok        ") << key << " "
+                 << cur.median << " GB/s vs. baseline " << base.median
+                 << " (" << showpos << 100.*(cur.median/base.median - 1.) << noshowpos
+                 << "%, threshold -" << 100.*threshold(key, cur) << "%)\n";
+        }
+    }
+    cout << (nfail ? "FAILED: " : "PASSED: ") << nfail << " regressions against " << baseline_file << "\n";
+    return nfail ? 1 : 0;
+}
+
+// Usage:
+//   bench [prf ...]                    - the full benchmark
+//   bench --compare                    - compare engines, including std::
+//   bench --latency [prf ...]          - per-draw latency percentiles
+//   bench --apps [threads ...]         - Monte Carlo application kernels,
+//       with 1, 2, 4, ... hardware_concurrency threads by default
+//   bench --gate-baseline FILE [prf ...] - write a regression-gate baseline
+//   bench --gate-check FILE [prf ...]    - compare against it.  The
+//       tolerance defaults to 0.10, or $BENCH_TOLERANCE.  Both pin
+//       themselves to the cpu they start on.
 int main(int argc, char**argv){
     cout << setprecision(2);
-    if(argc == 1){
-        for(auto& p : dispatch_map)
-            p.second(p.first);
+    string mode, gate_file;
+    auto p = argv+1;
+    if(*p && string(*p) == "--compare"){
+        compare_all();
+        return 0;
+    }
+    if(*p && string(*p) == "--apps"){
+        vector<unsigned> threads;
+        while(*++p)
+            threads.push_back(max(1, atoi(*p)));
+        apps_all(threads);
         return 0;
     }
-    for(auto p = argv+1; *p; p++){
-        auto found = dispatch_map.find(string(*p));
-        if(found != dispatch_map.end())
-            found->second(found->first);
+    if(*p && string(*p) == "--latency")
+        mode = *p++;
+    else if(*p && (string(*p) == "--gate-baseline" || string(*p) == "--gate-check")){
+        mode = *p++;
+        if(!*p){
+            cerr << "bench: " << mode << " requires a file name\n";
+            return 2;
+        }
+        gate_file = *p++;
+    }
+    vector<string> names;
+    bool all = !*p;
+    for( ; *p; p++){
+        if(dispatch_map.contains(*p))
+            names.push_back(*p);
         else
             cout << *p << " not found in dispatch map\n";
-    }        
+    }
+    if(all)
+        for(auto& e : dispatch_map)
+            names.push_back(e.first);
+
+    if(mode == "--latency"){
+        latency_header();
+        for(auto& name : names)
+            dispatch_map.at(name).latencies(name);
+        return 0;
+    }else if(mode == "--gate-check"){
+        gate_pin();
+        auto tolenv = getenv("BENCH_TOLERANCE");
+        return gate_check(gate_file, tolenv ? atof(tolenv) : 0.10, names);
+    }else if(mode == "--gate-baseline"){
+        gate_pin();
+        gate_results results;
+        for(auto& name : names)
+            dispatch_map.at(name).gate(name, results);
+        ofstream ofs(gate_file);
+        write_gate_results(ofs, results);
+        if(!ofs){
+            cerr << "bench: failed to write " << gate_file << "\n";
+            return 2;
+        }
+        write_gate_results(cout, results);
+        return 0;
+    }
+    for(auto& name : names)
+        dispatch_map.at(name).doit(name);
     return 0;
 }
@@ -0,0 +1,124 @@
+#pragma once
+
+// bernoulli_mask - fill a bit-packed buffer of 64-bit words in which
+// each bit is independently 1 with probability p.  E.g., for a
+// dropout mask of nbits bits:
+//
+//     bernoulli_mask bm(0.25);
+//     vector<uint64_t> mask((nbits+63)/64);
+//     bm.generate(eng, mask.begin(), mask.end());
+//
+// The probability is represented as p = k/2^m, with k odd.  Each mask
+// word is computed from m random 64-bit words, U[0..m), bit-sliced,
+// so that each word op decides 64 trials at once:
+//
+//     r = 0;
+//     for j in 0..m-1:   r = (bit j of k) ? (r | U[j]) : (r & U[j]);
+//
+// After step j, each bit of r is 1 with probability
+// (k mod 2^(j+1))/2^(j+1), so the result is exact.  Dyadic
+// probabilities, e.g., 1/2, 1/4, 3/8, are therefore cheap (m is 1, 2,
+// 3).  Any other p is rounded to the nearest multiple of 2^-precision
+// (default 32), so it costs at most 'precision' words per 64 bits.
+// p() reports the probability that's actually used.
+//
+// Mask word i is computed from engine values [i*m, (i+1)*m), counting
+// from the engine's state when generate was called.  So the work can
+// be split by counter range.  Each thread can copy the engine, skip
+// ahead with discard and fill its own part of the output:
+//
+//     auto e = eng;               // same state for every thread
+//     e.discard(first * bm.words_per_mask_word());
+//     bm.generate(e, mask.begin() + first, mask.begin() + last);
+//
+// The result is identical to a single call that fills the whole
+// buffer.  With counter_based_engine, discard is O(1).
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <iterator>
+#include <limits>
+#include <random>
+#include <stdexcept>
+
+namespace std{
+
+class bernoulli_mask{
+    uint64_t k = 0;     // the probability is k/2^m
+    unsigned m = 0;
+    bool ones = false;  // p == 1
+    // Values are taken from the engine this many at a time.
+    static constexpr size_t buffer_words = 2048;
+
+    template <typename G>
+    static void check_engine(){
+        static_assert(G::min() == 0 && G::max() == numeric_limits<uint64_t>::max(),
+                      "bernoulli_mask needs an engine that delivers 64-bit values");
+    }
+
+    void init(uint64_t k_, unsigned m_){
+        if(m_ > 63 || k_ > (uint64_t(1) << m_))
+            throw invalid_argument("bernoulli_mask:  requires k <= 2^m and m <= 63");
+        k = k_;
+        m = m_;
+        ones = (k == (uint64_t(1) << m));
+        if(ones || k == 0)
+            k = m = 0;
+        while(m && !(k&1)){
+            k >>= 1;
+            --m;
+        }
+    }
+    bernoulli_mask() = default;
+
+public:
+    // p rounded to the nearest multiple of 2^-precision.
+    explicit bernoulli_mask(double p, unsigned precision = 32){
+        if(!(p >= 0. && p <= 1.) || precision > 63)
+            throw invalid_argument("bernoulli_mask:  requires 0 <= p <= 1 and precision <= 63");
+        init(uint64_t(ldexp(p, precision) + 0.5), precision);
+    }
+    // p exactly k/2^m.  Requires k <= 2^m and m <= 63.
+    static bernoulli_mask dyadic(uint64_t k, unsigned m){
+        bernoulli_mask ret;
+        ret.init(k, m);
+        return ret;
+    }
+
+    double p() const { return ones ? 1. : ldexp(double(k), -int(m)); }
+    // How many engine values each 64-bit mask word consumes.
+    unsigned words_per_mask_word() const { return m; }
+
+    template <uniform_random_bit_generator G, output_iterator<const uint64_t&> O, sized_sentinel_for<O> S>
+    O generate(G& g, O out, S sen) const{
+        check_engine<G>();
+        auto n = sen - out;
+        if(m == 0)
+            return fill_n(out, n, ones ? ~uint64_t(0) : 0);
+        const size_t per_chunk = buffer_words/m;
+        array<uint64_t, buffer_words> U;
+        array<uint64_t, buffer_words> r;  // only the first per_chunk are used
+        while(n > 0){
+            size_t c = std::min<size_t>(per_chunk, n);
+            if constexpr (requires { g(U.begin(), U.end()); })
+                g(U.begin(), U.begin() + c*m);
+            else
+                for(size_t j=0; j<c*m; ++j)
+                    U[j] = g();
+            for(size_t i=0; i<c; ++i){
+                uint64_t ri = 0;
+                const uint64_t* u = &U[i*m];
+                for(unsigned j=0; j<m; ++j)
+                    ri = (k >> j) & 1 ? (ri | u[j]) : (ri & u[j]);
+                r[i] = ri;
+            }
+            out = ranges::copy(r.begin(), r.begin() + c, out).out;
+            n -= c;
+        }
+        return out;
+    }
+};
+
+} // namespace std
@@ -0,0 +1,155 @@
+// The implementation of the C API in cbe.h.  Each handle holds a
+// compact_counter_based_engine with its counter at zero.  A fill
+// copies it, discards up to 'first' (which is just an addition) and
+// makes one bulk call, so the per-value cost is the same as in C++.
+
+#include "cbe.h"
+#include "compact_counter_based_engine.hpp"
+#include <algorithm>
+#include <array>
+#include <limits>
+#include <type_traits>
+#include <new>
+
+using namespace std;
+
+struct cbe_engine{
+    virtual ~cbe_engine() = default;
+    virtual int word_size() const = 0;
+    // Values [first, first+n), converted to the type of out.
+    virtual void fill(uint64_t first, uint32_t* out, size_t n) const = 0;
+    virtual void fill(uint64_t first, uint64_t* out, size_t n) const = 0;
+};
+
+namespace{
+
+template <typename Eng>
+struct cbe_engine_impl : cbe_engine{
+    Eng proto;
+    template <typename R>
+    explicit cbe_engine_impl(R key) : proto(key){}
+    int word_size() const override{ return Eng::word_size; }
+    void fill(uint64_t first, uint32_t* out, size_t n) const override{ fill_impl(first, out, n); }
+    void fill(uint64_t first, uint64_t* out, size_t n) const override{ fill_impl(first, out, n); }
+    // N.B.  The 32-bit philox engines' result_type is uint_fast32_t,
+    // which may be wider than uint32_t.  The engine converts.
+    template <typename T>
+    void fill_impl(uint64_t first, T* out, size_t n) const{
+        Eng e = proto;
+        e.discard(first);
+        e(out, out + n);
+    }
+};
+
+template <typename Eng>
+int make(const uint64_t* key, size_t nkey, cbe_engine** out){
+    if(nkey > Eng::seed_count || (nkey && !key))
+        return CBE_EINVAL;
+    if constexpr (Eng::seed_word_size < 64)
+        if(any_of(key, key+nkey, [](uint64_t k){ return k >> Eng::seed_word_size; }))
+            return CBE_EINVAL;
+    *out = new(nothrow) cbe_engine_impl<Eng>(ranges::subrange(key, key+nkey));
+    return *out ? CBE_OK : CBE_ENOMEM;
+}
+
+// Call f with type_identity<engine type> for kind.  Returns false for
+// an unknown kind.
+template <typename F>
+bool with_kind(cbe_kind kind, F f){
+    switch(kind){
+    case CBE_PHILOX2X32: f(type_identity<compact_philox2x32>{}); return true;
+    case CBE_PHILOX4X32: f(type_identity<compact_philox4x32>{}); return true;
+    case CBE_PHILOX2X64: f(type_identity<compact_philox2x64>{}); return true;
+    case CBE_PHILOX4X64: f(type_identity<compact_philox4x64>{}); return true;
+    case CBE_THREEFRY2X32: f(type_identity<compact_threefry2x32>{}); return true;
+    case CBE_THREEFRY4X32: f(type_identity<compact_threefry4x32>{}); return true;
+    case CBE_THREEFRY2X64: f(type_identity<compact_threefry2x64>{}); return true;
+    case CBE_THREEFRY4X64: f(type_identity<compact_threefry4x64>{}); return true;
+    }
+    return false;
+}
+
+template <typename T>
+int fill_words(const cbe_engine* e, uint64_t first, T* out, size_t n){
+    if(!e || (n && !out))
+        return CBE_EINVAL;
+    if(e->word_size() != numeric_limits<T>::digits)
+        return CBE_EWORDSIZE;
+    e->fill(first, out, n);
+    return CBE_OK;
+}
+
+} // namespace
+
+extern "C"{
+
+int cbe_abi_version(void){
+    return CBE_ABI_VERSION;
+}
+
+size_t cbe_key_words(cbe_kind kind){
+    size_t ret = 0;
+    with_kind(kind, [&](auto t){ ret = decltype(t)::type::seed_count; });
+    return ret;
+}
+
+int cbe_word_size(cbe_kind kind){
+    int ret = 0;
+    with_kind(kind, [&](auto t){ ret = decltype(t)::type::word_size; });
+    return ret;
+}
+
+cbe_engine* cbe_create(cbe_kind kind, const uint64_t* key, size_t nkey){
+    cbe_engine* ret;
+    cbe_create_checked(kind, key, nkey, &ret);
+    return ret;
+}
+
+int cbe_create_checked(cbe_kind kind, const uint64_t* key, size_t nkey, cbe_engine** out){
+    if(!out)
+        return CBE_EINVAL;
+    *out = nullptr;
+    int ret = CBE_EINVAL;
+    with_kind(kind, [&](auto t){ ret = make<typename decltype(t)::type>(key, nkey, out); });
+    return ret;
+}
+
+void cbe_destroy(cbe_engine* e){
+    delete e;
+}
+
+int cbe_fill_u32(const cbe_engine* e, uint64_t first, uint32_t* out, size_t n){
+    return fill_words(e, first, out, n);
+}
+
+int cbe_fill_u64(const cbe_engine* e, uint64_t first, uint64_t* out, size_t n){
+    return fill_words(e, first, out, n);
+}
+
+int cbe_fill_double(const cbe_engine* e, uint64_t first, double* out, size_t n){
+    if(!e || (n && !out))
+        return CBE_EINVAL;
+    // Make the 64-bit words a chunk at a time.
+    const bool narrow = e->word_size() == 32;
+    constexpr size_t chunk = 512;
+    while(n){
+        size_t m = std::min(n, chunk);
+        array<uint64_t, chunk> u;
+        if(narrow){
+            array<uint32_t, 2*chunk> v;
+            e->fill(2*first, v.data(), 2*m);
+            for(size_t j=0; j<m; ++j)
+                u[j] = uint64_t(v[2*j]) << 32 | v[2*j+1];
+        }else{
+            e->fill(first, u.data(), m);
+        }
+        for(size_t j=0; j<m; ++j)
+            out[j] = (u[j] >> 11) * 0x1p-53;
+        out += m;
+        first += m;
+        n -= m;
+    }
+    return CBE_OK;
+}
+
+} // extern "C"
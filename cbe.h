@@ -0,0 +1,98 @@
+/* cbe.h - a C API for the counter-based engines, for C, Fortran
+   (via bind(C)) and anything else that can call C.  The implementation
+   is cbe.cpp, built as libcbe.so.
+
+   A cbe_engine is an opaque handle holding a generator kind and a key.
+   It has no position:  every fill function takes the index of the
+   first value it should deliver, so a caller can fill any part of the
+   stream, in any order, and a handle can be shared by threads.  Value
+   i of a handle is value i of the corresponding C++ engine (e.g.,
+   std::philox4x64 seeded with the same key words), i.e., counter
+   i/output_count, result i%output_count.
+
+       uint64_t key[2] = {seed, rank};
+       cbe_engine* e = cbe_create(CBE_PHILOX4X64, key, 2);
+       cbe_fill_double(e, first, buf, n);
+       cbe_destroy(e);
+
+   The functions that can fail return 0 on success, or a CBE_E*
+   code.  They never throw or abort.
+
+   The ABI is stable:  enumerators and functions are only ever added,
+   and cbe_abi_version() is incremented when they are.
+*/
+#ifndef CBE_H
+#define CBE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define CBE_ABI_VERSION 1
+
+/* libcbe.so is built with -fvisibility=hidden, so that the C++
+   template instantiations inside it stay private.  Only the functions
+   below are exported. */
+#if defined(__GNUC__)
+#define CBE_API __attribute__((visibility("default")))
+#else
+#define CBE_API
+#endif
+
+typedef enum cbe_kind{
+    CBE_PHILOX2X32 = 0,
+    CBE_PHILOX4X32 = 1,
+    CBE_PHILOX2X64 = 2,
+    CBE_PHILOX4X64 = 3,
+    CBE_THREEFRY2X32 = 4,
+    CBE_THREEFRY4X32 = 5,
+    CBE_THREEFRY2X64 = 6,
+    CBE_THREEFRY4X64 = 7
+} cbe_kind;
+
+enum{
+    CBE_OK = 0,
+    CBE_EINVAL = 1,     /* a NULL handle or buffer, or an unknown kind */
+    CBE_EWORDSIZE = 2,  /* e.g., cbe_fill_u32 on a 64-bit generator */
+    CBE_ENOMEM = 3      /* from cbe_create_checked */
+};
+
+typedef struct cbe_engine cbe_engine;
+
+CBE_API int cbe_abi_version(void);
+
+/* How many key words a kind takes, and how wide its values are (32 or
+   64 bits).  0 for an unknown kind. */
+CBE_API size_t cbe_key_words(cbe_kind kind);
+CBE_API int cbe_word_size(cbe_kind kind);
+
+/* Create a handle.  key may have up to cbe_key_words(kind) words;
+   missing words are zero.  Words of 32-bit kinds must be < 2^32.
+   cbe_create returns NULL if the arguments are bad or memory is
+   exhausted.  cbe_create_checked tells them apart:  it stores the
+   handle in *out and returns CBE_OK, or stores NULL and returns
+   CBE_EINVAL or CBE_ENOMEM. */
+CBE_API cbe_engine* cbe_create(cbe_kind kind, const uint64_t* key, size_t nkey);
+CBE_API int cbe_create_checked(cbe_kind kind, const uint64_t* key, size_t nkey, cbe_engine** out);
+CBE_API void cbe_destroy(cbe_engine* e);
+
+/* Fill out[0..n) with values first, first+1, ... of the stream.  u32
+   requires a 32-bit kind, u64 a 64-bit kind. */
+CBE_API int cbe_fill_u32(const cbe_engine* e, uint64_t first, uint32_t* out, size_t n);
+CBE_API int cbe_fill_u64(const cbe_engine* e, uint64_t first, uint64_t* out, size_t n);
+
+/* Fill out[0..n) with uniform doubles in [0, 1), each a multiple of
+   2^-53.  Double j is made from the top 53 bits of 64-bit value
+   first+j or, for 32-bit kinds, of the pair of values 2(first+j)
+   (high half) and 2(first+j)+1 (low half).  So 'first' counts
+   doubles, not values. */
+CBE_API int cbe_fill_double(const cbe_engine* e, uint64_t first, double* out, size_t n);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* CBE_H */
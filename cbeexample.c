@@ -0,0 +1,42 @@
+/* An example of the C API in cbe.h:  two 'ranks' each fill their own
+   part of one stream of doubles, and get exactly what a single fill of
+   the whole stream would have produced. */
+#include "cbe.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+/* Report a failed call and exit. */
+static void check(int err, const char* what){
+    if(err != CBE_OK){
+        fprintf(stderr, "cbeexample: %s failed with error %d\n", what, err);
+        exit(1);
+    }
+}
+
+int main(void){
+    enum{ N = 10, SPLIT = 3 };
+    uint64_t key[2] = {2024, 7};
+    cbe_engine* e;
+    check(cbe_create_checked(CBE_PHILOX4X64, key, 2, &e), "cbe_create_checked");
+    double whole[N], parts[N];
+    check(cbe_fill_double(e, 0, whole, N), "cbe_fill_double");
+    check(cbe_fill_double(e, 0, parts, SPLIT), "cbe_fill_double");
+    check(cbe_fill_double(e, SPLIT, parts + SPLIT, N - SPLIT), "cbe_fill_double");
+    int ret = 0;
+    for(int i=0; i<N; ++i){
+        if(whole[i] != parts[i]){
+            fprintf(stderr, "cbeexample: value %d differs\n", i);
+            ret = 1;
+        }
+        printf("%d %.17g\n", i, whole[i]);
+    }
+    /* A 64-bit generator has no 32-bit values. */
+    uint32_t u32[4];
+    int err = cbe_fill_u32(e, 0, u32, 4);
+    if(err != CBE_EWORDSIZE){
+        fprintf(stderr, "cbeexample: cbe_fill_u32 returned %d, not CBE_EWORDSIZE\n", err);
+        ret = 1;
+    }
+    cbe_destroy(e);
+    return ret;
+}
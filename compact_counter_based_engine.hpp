@@ -0,0 +1,212 @@
+#pragma once
+
+// compact_counter_based_engine<prf, c> - a counter_based_engine that
+// doesn't save the prf's results.  Its entire state is the prf's input
+// array, in which the c counter words hold the index of the next
+// *value* (rather than the next block).  The block containing it is
+// recomputed whenever it's needed.  So, e.g., a compact philox4x64 is
+// 6 words rather than 10, and a compact threefry4x64 is 8 rather than
+// 12.
+//
+// For the same prf, c and seed, it produces the same sequence as
+// counter_based_engine<prf, c>, except that its period is 2^(c*w)
+// values rather than 2^(c*w) blocks.
+//
+// The price is paid by operator()(), which calls the prf for every
+// value.  Bulk generation, operator()(b, e), hands whole blocks to
+// prf::generate and calls the prf at most twice more for the partial
+// blocks at either end.  So the compact engine is a good choice for
+// many small objects that each make a few bulk calls or a few draws,
+// but not for long runs of one-at-a-time draws.
+
+#include "detail.hpp"
+#include "counter_based_engine.hpp"
+#include <array>
+#include <limits>
+#include <algorithm>
+#include <iosfwd>
+#include <iterator>
+#include <ranges>
+
+namespace std{
+
+template<typename prf, size_t c>
+class compact_counter_based_engine{
+    static_assert(c > 0);
+public:
+    using result_type = prf::output_value_type;
+    using seed_value_type = prf::input_value_type;
+    static constexpr size_t word_size = prf::output_word_size;
+    static constexpr size_t counter_count = c;
+    static constexpr size_t counter_word_size = prf::input_word_size;
+    static constexpr size_t seed_count = prf::input_count - counter_count;
+    static constexpr size_t seed_word_size = prf::input_word_size;
+private:
+    using prf_result_type = array<result_type, prf::output_count>;
+    static constexpr size_t result_count = prf::output_count;
+    static constexpr size_t input_count = prf::input_count;
+    static constexpr size_t input_word_size = prf::input_word_size;
+    using input_value_type = prf::input_value_type;
+    using in_type = array<input_value_type, input_count>;
+    static constexpr auto in_mask = detail::fffmask<input_value_type, prf::input_word_size>;
+    static constexpr auto result_mask = detail::fffmask<result_type,
+                                                        std::min<size_t>(numeric_limits<result_type>::digits, word_size)>;
+
+    in_type in;
+
+    // The counter is the index of the next value.
+    using counter_type = detail::uint_fast<c*prf::input_word_size>;
+    static_assert(input_word_size * counter_count <= numeric_limits<counter_type>::digits);
+    counter_type get_counter() const{
+        counter_type ret = 0;
+        for(size_t i=0; i<counter_count; ++i)
+            ret |= counter_type(in[i])<<(input_word_size * i);
+        return ret;
+    }
+    static void set_counter(in_type& inn, counter_type newctr){
+        for(size_t i=0; i<counter_count; ++i)
+            inn[i] = (newctr >> (input_word_size*i)) & in_mask;
+    }
+    // The block that contains value v.
+    prf_result_type block(counter_type v) const{
+        in_type inn = in;
+        set_counter(inn, v/result_count);
+        prf_result_type ret;
+        prf{}(ranges::begin(inn), ranges::begin(ret));
+        return ret;
+    }
+
+public:
+    static constexpr result_type min(){ return 0; }
+    static constexpr result_type max(){ return result_mask; };
+    static constexpr result_type default_seed = 20111115u;
+
+    result_type operator()(){
+        auto v = get_counter();
+        auto ret = block(v)[v%result_count];
+        set_counter(in, v+1);
+        return ret;
+    }
+
+    template <output_iterator<const result_type&> O, sized_sentinel_for<O> S>
+    O operator()(O out, S sen){
+        auto n = sen - out;
+        if(n <= 0)
+            return out;
+        auto v = get_counter();
+        set_counter(in, v + n);
+        // The rest of a partially consumed block.
+        if(auto ri = v%result_count){
+            auto b = block(v);
+            while(ri < result_count && n){
+                *out++ = b[ri++];
+                --n;
+                ++v;
+            }
+        }
+        // Whole blocks, with a lazily constructed input range.
+        counter_type c0 = v/result_count;
+        counter_type nprf = n/result_count;
+        if(nprf){
+            in_type inn;
+            auto inrange = ranges::views::iota(c0, c0+nprf) |
+                           ranges::views::transform([&](auto ctr){
+                                                        inn = in;
+                                                        set_counter(inn, ctr);
+                                                        return ranges::begin(inn);
+                                                    });
+            out = prf{}.generate(inrange, out);
+            n -= nprf*result_count;
+            v += nprf*result_count;
+        }
+        // Stragglers.
+        if(n){
+            auto b = block(v);
+            for(size_t i=0; n--; ++i)
+                *out++ = b[i];
+        }
+        return out;
+    }
+
+    // Constructors and seed members, as in counter_based_engine.
+    compact_counter_based_engine() : compact_counter_based_engine(default_seed){}
+    explicit compact_counter_based_engine(result_type s){ seed(s); }
+    void seed(result_type value = default_seed){
+        array<seed_value_type, seed_count> K = { input_value_type(value) & in_mask };
+        seed(K);
+    }
+    template <typename SeedSeq>
+    requires (!detail::integral_input_range<SeedSeq>)
+    explicit compact_counter_based_engine(SeedSeq& q){ seed(q); }
+    template <typename SeedSeq>
+    requires (!detail::integral_input_range<SeedSeq>)
+    void seed(SeedSeq& s){
+        constexpr size_t N32_per_in = (input_word_size-1)/32 + 1;
+        array<uint_fast32_t, N32_per_in * seed_count> k32;
+        s.generate(k32.begin(), k32.end());
+        auto k32p = begin(k32);
+        array<seed_value_type, seed_count> iv;
+        for(auto& v : iv){
+            v = 0;
+            for(size_t j=0; j<N32_per_in; ++j)
+                v |= seed_value_type(*k32p++) << (32*j);
+            v &= in_mask;
+        }
+        seed(iv);
+    }
+    template <integral T>
+    explicit compact_counter_based_engine(initializer_list<T> il){
+        seed(il);
+    }
+    template <integral T>
+    void seed(initializer_list<T> il){
+        seed(ranges::subrange(il));
+    }
+    template <detail::integral_input_range InRange>
+    explicit compact_counter_based_engine(InRange iv){
+        seed(iv);
+    }
+    template <detail::integral_input_range InRange>
+    void seed(InRange _in){
+        auto inp = ranges::begin(_in);
+        auto ine = ranges::end(_in);
+        for(size_t i=counter_count; i<input_count; ++i)
+            in[i] = (inp == ine) ? 0 : seed_value_type(*inp++) & in_mask;
+        set_counter(in, 0);
+    }
+
+    bool operator==(const compact_counter_based_engine& rhs) const { return in == rhs.in; }
+    bool operator!=(const compact_counter_based_engine& rhs) const { return !operator==(rhs); }
+
+    // discard is just an addition (modulo the period).
+    void discard(unsigned long long jump){
+        set_counter(in, get_counter() + jump);
+    }
+
+    template <typename CharT, typename Traits>
+    friend basic_ostream<CharT, Traits>& operator<<(basic_ostream<CharT, Traits>& os, const compact_counter_based_engine& p){
+        ostream_iterator<input_value_type> osin(os, " ");
+        ranges::copy(p.in, osin);
+        return os;
+    }
+    template<typename CharT, typename Traits>
+    friend basic_istream<CharT, Traits>& operator>>(basic_istream<CharT, Traits>& is, compact_counter_based_engine& p){
+        istream_iterator<input_value_type> isiin(is);
+        copy_n(isiin, input_count, begin(p.in));
+        return is;
+    }
+
+    using prf_type = prf;
+};
+
+using compact_philox2x32 = compact_counter_based_engine<philox2x32_prf, 2>;
+using compact_philox4x32 = compact_counter_based_engine<philox4x32_prf, 2>;
+using compact_philox2x64 = compact_counter_based_engine<philox2x64_prf, 1>;
+using compact_philox4x64 = compact_counter_based_engine<philox4x64_prf, 1>;
+
+using compact_threefry2x32 = compact_counter_based_engine<threefry2x32_prf, 2>;
+using compact_threefry4x32 = compact_counter_based_engine<threefry4x32_prf, 2>;
+using compact_threefry2x64 = compact_counter_based_engine<threefry2x64_prf, 1>;
+using compact_threefry4x64 = compact_counter_based_engine<threefry4x64_prf, 1>;
+
+} // namespace std
@@ -1,15 +1,21 @@
 #pragma once
 #include "detail.hpp"
+#include "prf_counters.hpp"
+#include "autotune.hpp"
 
 #include <limits>
 #include <array>
 #include <random>
 #include <iosfwd>
 #include <algorithm>
+#include <bit>
 #include <cstring>
+#include <functional>
+#include <span>
 #include <vector>
 #include "threefry_prf.hpp"
 #include "philox_prf.hpp"
+#include "squares_prf.hpp"
 
 namespace std{
 
@@ -74,6 +80,121 @@ private:
         for(size_t i=0; i<counter_count; ++i)
             inn[i] = (newctr >> (input_word_size*i)) & in_mask;
     }
+    // Call the prf's bulk generator on nprf consecutive counters,
+    // starting at c0.  Lazily construct the input range.  No need to
+    // allocate and fill a big chunk of memory.  If !ordered, and the
+    // prf has one, use its unordered_results overload.
+    auto block_inputs(counter_type c0, counter_type nprf, in_type& inn) const{
+        return ranges::views::iota(c0, c0+nprf) |
+               ranges::views::transform([this, &inn](auto ctr){
+                                            inn = in;
+                                            set_counter(inn, ctr);
+                                            return ranges::begin(inn);
+                                        });
+    }
+    template <bool ordered, typename O>
+    O generate_blocks(counter_type c0, counter_type nprf, O out) const{
+        in_type inn;
+        auto inrange = block_inputs(c0, nprf, inn);
+        if constexpr (!ordered && requires { prf{}.generate(unordered_results, inrange, out); })
+            return prf{}.generate(unordered_results, inrange, out);
+        else
+            return prf{}.generate(inrange, out);
+    }
+    // The prf's unordered_results overload permutes its results in
+    // groups of this many blocks.  (1 if it doesn't have one.)
+    static constexpr size_t unordered_group_count = [](){
+        if constexpr (requires { prf::unordered_group_count; })
+            return prf::unordered_group_count;
+        else
+            return size_t(1);
+    }();
+    // How many prf blocks fit in the staging buffer used for
+    // non-contiguous output iterators: prf_tuned<prf>().staging_bytes
+    // (4k bytes unless autotuned), but always a whole number of
+    // unordered groups so that staging doesn't change fill_unordered's
+    // permutation.
+    static constexpr size_t staging_count_for(size_t bytes){
+        size_t ngroups = std::max<size_t>(1, bytes/sizeof(prf_result_type)/unordered_group_count);
+        return ngroups * unordered_group_count;
+    }
+    static constexpr size_t max_staging_count =
+        staging_count_for(detail::autotuning ? detail::max_staging_bytes : detail::default_staging_bytes);
+    static size_t staging_count(){
+        if constexpr (detail::autotuning)
+            return staging_count_for(prf_tuned<prf>().staging_bytes);
+        else
+            return max_staging_count;
+    }
+
+    void instrument_bulk([[maybe_unused]] size_t n){
+        detail::instrument([&](auto& ctrs){
+                               ctrs.bulk_calls += 1;
+                               ctrs.bulk_values += n;
+                               ctrs.bulk_size_log2[bit_width(n)] += 1;
+                               ctrs.bytes += n*(word_size/8);
+                           });
+    }
+
+    // The guts of operator()(O, S) and fill_unordered.
+    template <bool ordered, typename O, typename S>
+    O fill(O out, S sen){
+        auto n = sen - out;
+        
+        // Deliver any saved results
+        auto ri = ridxref();
+        if(ri && n){
+            detail::instrument([&](auto& ctrs){ ctrs.saved_values += std::min<size_t>(n, result_count - ri); });
+            while(ri < result_count && n){
+                *out++ = results[ri++];
+                --n;
+            }
+            if(ri == result_count)
+                ri = 0;
+        }
+            
+        // Call the bulk generator
+        auto nprf = n/result_count;
+        // N.B.  The test for nprf lets the compiler drop the call
+        // entirely when it can see that n < result_count, e.g., in
+        // the single-value operator()() above.
+        if(nprf){
+            auto c0 = get_counter();
+            if constexpr (contiguous_iterator<O>){
+                detail::instrument([&](auto& ctrs){ ctrs.generate_values += nprf*result_count; });
+                out = generate_blocks<ordered>(c0, nprf, out);
+            }else{
+                detail::instrument([&](auto& ctrs){ ctrs.staged_values += nprf*result_count; });
+                // The prf can write whole simd vectors into contiguous
+                // memory, so give it a small staging buffer and copy
+                // from there.
+                array<result_type, max_staging_count*result_count> staging;
+                const counter_type nstaging = staging_count();
+                for(counter_type done = 0; done < nprf; ){
+                    auto nstage = std::min<counter_type>(nstaging, nprf-done);
+                    auto e = generate_blocks<ordered>(c0+done, nstage, staging.data());
+                    out = ranges::copy(staging.data(), e, out).out;
+                    done += nstage;
+                }
+            }
+            n -= nprf*result_count;
+            set_counter(in, c0 + nprf);
+        }
+
+        // Restock the results array
+        if(ri == 0 && n){
+            detail::instrument([&](auto& ctrs){ ctrs.refills += 1; ctrs.straggler_values += n; });
+            prf{}(std::begin(in), std::begin(results));
+            incr_counter();
+        }
+            
+        // Finish off any stragglers.
+        while(n--)
+            *out++ = results[ri++];
+        ridxref() = ri;
+        return out;
+    }
+
     void incr_counter(){
         in[0] = (in[0] + 1) & in_mask;
         for(size_t i=1; i<counter_count; ++i){
@@ -109,7 +230,8 @@ public:
         return ret;
 #else
         result_type ret;
-        (*this)(&ret, &ret+1);
+        detail::instrument([](auto& ctrs){ ctrs.scalar_values += 1; ctrs.bytes += word_size/8; });
+        fill<true>(&ret, &ret+1);
         return ret;
 #endif        
     }
@@ -122,47 +244,8 @@ public:
     // Worth the trouble?
     template <output_iterator<const result_type&> O, sized_sentinel_for<O> S>
     O operator()(O out, S sen){
-        auto n = sen - out;
-        
-        // Deliver any saved results
-        auto ri = ridxref();
-        if(ri && n){
-            while(ri < result_count && n){
-                *out++ = results[ri++];
-                --n;
-            }
-            if(ri == result_count)
-                ri = 0;
-        }
-            
-        // Call the bulk generator
-        auto nprf = n/result_count;
-        // lazily construct the input range.  No need
-        // to allocate and fill a big chunk of memory
-        using namespace std::ranges;
-        auto c0 = get_counter();
-        in_type inn;
-        out = prf{}.generate(views::iota(c0, c0+nprf) |
-                             views::transform([&](auto ctr){
-                                                  inn = in;
-                                                  set_counter(inn, ctr);
-                                                  return ranges::begin(inn);
-                                              }),
-                             out);
-        n -= nprf*result_count;
-        set_counter(in, c0 + nprf);
-
-        // Restock the results array
-        if(ri == 0 && n){
-            prf{}(std::begin(in), std::begin(results));
-            incr_counter();
-        }
-            
-        // Finish off any stragglers.
-        while(n--)
-            *out++ = results[ri++];
-        ridxref() = ri;
-        return out;
+        instrument_bulk(sen - out);
+        return fill<true>(out, sen);
     }
 
     // And now, the requirements for a random number engine:
@@ -174,8 +257,10 @@ public:
         seed(K);
     }
     template <typename SeedSeq> // FIXME - disambiguate result_type
+    requires (!detail::integral_input_range<SeedSeq>)
     explicit counter_based_engine(SeedSeq& q){ seed(q); }
     template <typename SeedSeq> // FIXME - disambiguate result_type
+    requires (!detail::integral_input_range<SeedSeq>)
     void seed(SeedSeq& s){
         // Generate 32-bits at a time with the SeedSeq.
         // Generate enough to fill prf::in
@@ -204,6 +289,12 @@ public:
     //  an input_value_type that's wider than w.
     void discard(unsigned long long jump) {
         auto oldridx = ridxref();
+        detail::instrument([&](auto& ctrs){
+                               ctrs.discard_calls += 1;
+                               ctrs.discarded_values += jump;
+                               if(oldridx && jump >= result_count - oldridx)
+                                   ctrs.wasted_values += result_count - oldridx;
+                           });
         unsigned newridx = (jump + oldridx) % result_count;
         unsigned long long jumpll = jump + oldridx - (!oldridx && newridx);
         jumpll /= result_count;
@@ -213,8 +304,10 @@ public:
         input_value_type newctr = (jumpctr-1 + oldctr) & in_mask;
         set_counter(in, newctr);
         if(newridx){
-            if(jumpctr)
+            if(jumpctr){
+                detail::instrument([&](auto& ctrs){ ctrs.wasted_values += newridx; });
                 prf{}(begin(in), begin(results));
+            }
             incr_counter();
         }else if(newctr == 0){
             newridx = result_count;
@@ -252,6 +345,86 @@ public:
     // - the type of the underlying prf and a reference to it.
     using prf_type = prf;
 
+    // - a bulk generator for callers that don't care about the order
+    // of the values within a call, e.g., shuffles or bulk noise.
+    // fill_unordered(b, e) writes exactly the same values to [b, e)
+    // and leaves the engine in exactly the same state as (*this)(b, e)
+    // would.  Only the order of the values may differ: leftover
+    // values saved from a previous call come first and any
+    // stragglers come last, just as in operator()(O, S), but the
+    // whole prf blocks in between are permuted as if by
+    // prf_type::generate(unordered_results, ...), applied to
+    // consecutive counters starting with the first whole block
+    // (see threefry_prf::generate).  If the prf has no
+    // unordered_results overload, the order is unchanged.
+    template <output_iterator<const result_type&> O, sized_sentinel_for<O> S>
+    O fill_unordered(O out, S sen){
+        instrument_bulk(sen - out);
+        return fill<false>(out, sen);
+    }
+
+    // - a fused alternative to operator()(b, e) for consumers that
+    // reduce the values immediately (sums, histograms, comparisons),
+    // without an output array.  for_each_block(n, f) consumes the next
+    // n values, and leaves the engine in the same state, exactly as
+    // (*this)(b, b+n) would.  But instead of writing the values to
+    // [b, b+n), it calls f(span<const result_type>) with consecutive
+    // pieces of them, in order.  If the prf has a for_each_block
+    // member (threefry and squares do), the pieces come straight
+    // from its simd kernel, so once f is inlined, the prf and the
+    // consumer are fused.  Otherwise, they're staged through a small,
+    // L1-resident buffer.  Either way, the pieces are short, and f
+    // shouldn't assume anything about their lengths.  Like
+    // std::for_each, it returns f, so a stateful functor's state isn't
+    // lost.
+    template <typename F>
+    requires invocable<F&, span<const result_type>>
+    F for_each_block(unsigned long long n, F f){
+        instrument_bulk(n);
+        auto ri = ridxref();
+        if(ri && n){
+            size_t m = std::min<unsigned long long>(n, result_count - ri);
+            detail::instrument([&](auto& ctrs){ ctrs.saved_values += m; });
+            f(span<const result_type>(results.data() + ri, m));
+            ri += m;
+            n -= m;
+            if(ri == result_count)
+                ri = 0;
+        }
+        counter_type nprf = n/result_count;
+        if(nprf){
+            auto c0 = get_counter();
+            if constexpr (requires { prf{}.for_each_block(ranges::views::empty<input_value_type*>, f); }){
+                detail::instrument([&](auto& ctrs){ ctrs.fused_values += nprf*result_count; });
+                in_type inn;
+                prf{}.for_each_block(block_inputs(c0, nprf, inn), ref(f));
+            }else{
+                detail::instrument([&](auto& ctrs){ ctrs.staged_values += nprf*result_count; });
+                array<result_type, max_staging_count*result_count> staging;
+                const counter_type nstaging = staging_count();
+                for(counter_type done = 0; done < nprf; ){
+                    auto nstage = std::min<counter_type>(nstaging, nprf-done);
+                    auto e = generate_blocks<true>(c0+done, nstage, staging.data());
+                    f(span<const result_type>(staging.data(), e));
+                    done += nstage;
+                }
+            }
+            n -= nprf*result_count;
+            set_counter(in, c0 + nprf);
+        }
+        if(ri == 0 && n){
+            detail::instrument([&](auto& ctrs){ ctrs.refills += 1; ctrs.straggler_values += n; });
+            prf{}(std::begin(in), std::begin(results));
+            incr_counter();
+        }
+        if(n){
+            f(span<const result_type>(results.data() + ri, n));
+            ri += n;
+        }
+        ridxref() = ri;
+        return f;
+    }
+
     // - how many values are consumed in the seed(InRange) member
     // and corresponding constructor?
     
@@ -302,5 +475,10 @@ using threefry2x32 = counter_based_engine<threefry2x32_prf, 2>;
 using threefry4x32 = counter_based_engine<threefry4x32_prf, 2>;
 using threefry2x64 = counter_based_engine<threefry2x64_prf, 1>;
 using threefry4x64 = counter_based_engine<threefry4x64_prf, 1>;
+using threefry8x64 = counter_based_engine<threefry8x64_prf, 1>;
+using threefry16x64 = counter_based_engine<threefry16x64_prf, 1>;
+
+using squares32 = counter_based_engine<squares32_prf, 1>;
+using squares64 = counter_based_engine<squares64_prf, 1>;
 
 } // namespace std
@@ -0,0 +1,245 @@
+#pragma once
+
+// counter_based_grid<prf, D, c> - random values addressed by a site's
+// coordinates on a D-dimensional lattice, and a component index, e.g.,
+// "the 2nd random number at (x, y, z, t)".  The value depends only on
+// the key, the coordinates and the component, not on who asks or in
+// what order, so a domain-decomposed simulation gets bit-identical
+// results however the lattice is divided among ranks and threads:
+//
+//     counter_based_grid<philox4x64_prf, 4> g({seed}, {8, 8, 8, 6}, 3);
+//     g({x, y, z, t}, 2)          // component 2 of site (x, y, z, t)
+//     g.fill(lo, hi, out)         // every component of every site in [lo, hi)
+//     g.fill(lo, hi, stride, out) // ... of every stride'th site
+//
+// The prf's first c input words are the counter, and the rest hold
+// the key.  The counter is divided into bit-fields:  one for each
+// coordinate, bits[d] wide, and one for the block within the site, as
+// wide as it needs to be for 'components' values.  A field never
+// straddles two words.  The constructor throws invalid_argument if
+// the fields don't fit in c words, so distinct sites and components
+// always get distinct prf inputs, i.e., there are no collisions.
+//
+// Coordinates are taken modulo 2^bits[d].  So they must be less than
+// that for distinct sites to get distinct values.  (Conversely, with
+// power-of-two periodic extents, halo coordinates like -1 wrap around
+// by themselves.)
+//
+// fill writes the values in row-major order (the last coordinate
+// varies fastest), with a site's components together.  Each row is a
+// single call to prf::generate, with a lazily constructed input range,
+// so it gets the prf's simd kernels, just like counter_based_engine's
+// bulk calls.
+//
+// The counters of site 0 coincide with those of a counter_based_engine
+// with the same key, so don't use the same key for both.
+
+#include "detail.hpp"
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cstdint>
+#include <initializer_list>
+#include <iterator>
+#include <ranges>
+#include <stdexcept>
+#include <vector>
+
+namespace std{
+
+template <typename prf, size_t D, size_t c = prf::input_count - 1>
+class counter_based_grid{
+    static_assert(D > 0);
+    static_assert(c > 0 && c <= prf::input_count);
+    static_assert(prf::input_word_size <= 64);
+public:
+    using result_type = prf::output_value_type;
+    using coord_type = int64_t;
+    using coords_type = array<coord_type, D>;
+    using size_type = uint64_t;
+    static constexpr size_t dimensions = D;
+    static constexpr size_t counter_count = c;
+    static constexpr size_t key_count = prf::input_count - c;
+
+private:
+    static constexpr size_t result_count = prf::output_count;
+    static constexpr size_t input_count = prf::input_count;
+    static constexpr size_t input_word_size = prf::input_word_size;
+    using input_value_type = prf::input_value_type;
+    using in_type = array<input_value_type, input_count>;
+    using prf_result_type = array<result_type, result_count>;
+    static constexpr auto in_mask = detail::fffmask<input_value_type, prf::input_word_size>;
+
+    struct field{
+        size_t word = 0;
+        unsigned shift = 0;
+        input_value_type mask = 0;
+    };
+    static void put(in_type& inn, const field& f, uint64_t v){
+        inn[f.word] |= (input_value_type(v) & f.mask) << f.shift;
+    }
+
+    in_type in{};               // the key, with the counter words zero
+    field block_field;          // the block within a site
+    array<field, D> coord_fields;
+    size_t components = 1;
+    size_t site_blocks = 1;     // ceil(components/result_count)
+
+    // The prf input for block 0 of site x.
+    in_type site_input(const coords_type& x) const{
+        in_type inn = in;
+        for(size_t d=0; d<D; ++d)
+            put(inn, coord_fields[d], x[d]);
+        return inn;
+    }
+
+    static size_type extent(coord_type lo, coord_type hi, coord_type stride){
+        return hi > lo ? (size_type(hi - lo) + stride - 1)/stride : 0;
+    }
+
+    // All the components of the n sites x, x + s*e_{D-1}, ...
+    template <typename O>
+    O row(const coords_type& x, coord_type s, size_type n, O out) const{
+        in_type base = site_input(x);
+        base[coord_fields[D-1].word] &= ~(coord_fields[D-1].mask << coord_fields[D-1].shift);
+        const coord_type x0 = x[D-1];
+        in_type inn;
+        // Sites [first, first+count) of the row, as prf blocks.
+        auto blocks = [&](size_type first, size_type count, auto o){
+            if(site_blocks == 1)
+                return prf{}.generate(ranges::views::iota(first, first + count) |
+                                      ranges::views::transform([&](size_type k){
+                                                                   inn = base;
+                                                                   put(inn, coord_fields[D-1], x0 + coord_type(k)*s);
+                                                                   return ranges::begin(inn);
+                                                               }),
+                                      o);
+            return prf{}.generate(ranges::views::iota(first*site_blocks, (first + count)*site_blocks) |
+                                  ranges::views::transform([&](size_type k){
+                                                               inn = base;
+                                                               put(inn, coord_fields[D-1], x0 + coord_type(k/site_blocks)*s);
+                                                               put(inn, block_field, k%site_blocks);
+                                                               return ranges::begin(inn);
+                                                           }),
+                                  o);
+        };
+        if(components == site_blocks*result_count)
+            return blocks(0, n, out);
+        // Some of each site's last block is unused, so generate whole
+        // sites into a buffer and copy out the components.
+        const size_t site_values = site_blocks*result_count;
+        const size_type chunk = std::max<size_type>(1, 256/site_blocks);
+        vector<result_type> buf(std::min(n, chunk)*site_values);
+        for(size_type first=0; first<n; first += chunk){
+            size_type m = std::min(chunk, n - first);
+            blocks(first, m, buf.data());
+            for(size_type i=0; i<m; ++i)
+                out = ranges::copy_n(buf.data() + i*site_values, components, out).out;
+        }
+        return out;
+    }
+
+public:
+    counter_based_grid() = default;
+
+    // The key range is treated like the argument of
+    // counter_based_engine::seed(InRange).  bits[d] is the width of
+    // coordinate d's field, e.g., bit_width(extent-1).
+    template <detail::integral_input_range InRange>
+    counter_based_grid(InRange key, const array<unsigned, D>& bits, size_t components_ = 1) :
+        components(components_ ? components_ : 1),
+        site_blocks((components + result_count - 1)/result_count)
+    {
+        auto kp = ranges::begin(key);
+        auto ke = ranges::end(key);
+        for(size_t i=counter_count; i<input_count; ++i)
+            in[i] = (kp == ke) ? 0 : input_value_type(*kp++) & in_mask;
+        // Lay out the fields in order, starting a new word whenever
+        // the next field doesn't fit in the current one.
+        size_t word = 0;
+        unsigned used = 0;
+        auto place = [&](field& f, unsigned nbits){
+            if(nbits > input_word_size)
+                throw invalid_argument("counter_based_grid:  a coordinate is wider than the prf's input words");
+            if(used + nbits > input_word_size){
+                ++word;
+                used = 0;
+            }
+            if(word >= counter_count)
+                throw invalid_argument("counter_based_grid:  the coordinates and components don't fit in the counter");
+            f.word = word;
+            f.shift = nbits ? used : 0;
+            f.mask = nbits ? in_mask >> (input_word_size - nbits) : 0;
+            used += nbits;
+        };
+        place(block_field, bit_width(site_blocks - 1));
+        for(size_t d=0; d<D; ++d)
+            place(coord_fields[d], bits[d]);
+    }
+    template <integral T>
+    counter_based_grid(initializer_list<T> key, const array<unsigned, D>& bits, size_t components_ = 1) :
+        counter_based_grid(ranges::subrange(key), bits, components_)
+    {}
+
+    size_t component_count() const { return components; }
+
+    // Component 'comp' of site x.
+    result_type operator()(const coords_type& x, size_t comp = 0) const{
+        in_type inn = site_input(x);
+        put(inn, block_field, comp/result_count);
+        prf_result_type r;
+        prf{}(ranges::begin(inn), ranges::begin(r));
+        return r[comp%result_count];
+    }
+
+    // How many values fill(lo, hi, stride, out) writes.
+    size_type count(const coords_type& lo, const coords_type& hi, const coords_type& stride) const{
+        size_type n = components;
+        for(size_t d=0; d<D; ++d)
+            n *= extent(lo[d], hi[d], stride[d]);
+        return n;
+    }
+    size_type count(const coords_type& lo, const coords_type& hi) const{
+        coords_type ones;
+        ones.fill(1);
+        return count(lo, hi, ones);
+    }
+
+    // Write every component of the sites x with lo[d] <= x[d] < hi[d]
+    // and (x[d]-lo[d]) a multiple of stride[d] > 0, in row-major order.
+    template <weakly_incrementable O>
+    requires indirectly_writable<O, result_type>
+    O fill(const coords_type& lo, const coords_type& hi, const coords_type& stride, O out) const{
+        for(size_t d=0; d<D; ++d){
+            if(stride[d] <= 0)
+                throw invalid_argument("counter_based_grid::fill:  strides must be positive");
+            if(hi[d] <= lo[d])
+                return out;
+        }
+        const size_type n = extent(lo[D-1], hi[D-1], stride[D-1]);
+        coords_type x = lo;
+        for(;;){
+            out = row(x, stride[D-1], n, out);
+            // Advance the outer coordinates, odometer-style.
+            size_t d = D-1;
+            for(; d>0; --d){
+                if((x[d-1] += stride[d-1]) < hi[d-1])
+                    break;
+                x[d-1] = lo[d-1];
+            }
+            if(d == 0)
+                return out;
+        }
+    }
+    template <weakly_incrementable O>
+    requires indirectly_writable<O, result_type>
+    O fill(const coords_type& lo, const coords_type& hi, O out) const{
+        coords_type ones;
+        ones.fill(1);
+        return fill(lo, hi, ones, out);
+    }
+
+    using prf_type = prf;
+};
+
+} // namespace std
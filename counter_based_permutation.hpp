@@ -0,0 +1,191 @@
+#pragma once
+
+// counter_based_permutation<prf> - a keyed, random-looking bijection
+// on [0, N), computed on demand in O(1) time and space.  E.g.,
+//
+//     counter_based_permutation<> perm(N, {key0, key1});
+//     perm.permute(i)  - the i'th element of the shuffled [0, N).
+//     perm.inverse(j)  - the i for which permute(i) == j.
+//     perm.permute(first, last, out) - writes permute(i) for i in
+//                        [first, last) to out.
+//
+// All members are const, and there's no hidden state, so disjoint
+// ranges of [0, N) can be permuted by different threads.
+//
+// It's a balanced Feistel network on the smallest domain of 2^(2h)
+// values that covers [0, N), with the prf as the round function,
+// followed by "cycle-walking":  if a value lands outside [0, N), it's
+// permuted again until it lands inside.  Since 2^(2h) < 4N, the
+// expected number of walks is less than 4.
+//
+// The prf is called with the half-block in in[0], the round number in
+// in[1] and the key in the remaining input words.  The low h bits of
+// its first output word are the round function's value.
+
+#include "detail.hpp"
+#include "threefry_prf.hpp"
+#include <array>
+#include <bit>
+#include <cstdint>
+#include <ranges>
+#include <initializer_list>
+
+namespace std{
+
+template <typename prf = threefry2x64_prf, size_t rounds = 8>
+class counter_based_permutation{
+    static_assert(prf::input_count >= 3);
+    // h can be as large as 32, and it must fit in one word.
+    static_assert(prf::input_word_size >= 32 && prf::output_word_size >= 32);
+    static_assert(rounds >= 4);   // Luby-Rackoff
+public:
+    using value_type = uint64_t;
+    using prf_type = prf;
+    static constexpr size_t key_count = prf::input_count - 2;
+
+private:
+    using input_value_type = prf::input_value_type;
+    using in_type = array<input_value_type, prf::input_count>;
+    static constexpr auto in_mask = detail::fffmask<input_value_type, prf::input_word_size>;
+    // The number of indices permuted together by the bulk permute.
+    static constexpr size_t batch_size = 64;
+
+    uint64_t n = 0;
+    unsigned h = 1;         // bits in each half of the Feistel block
+    uint64_t hmask = 1;
+    in_type in{};           // in[0] and in[1] are set for each round
+
+    // Apply all the Feistel rounds to x (or undo them, if !forward).
+    template <bool forward>
+    uint64_t feistel(uint64_t x) const{
+        uint64_t L = x >> h;
+        uint64_t R = x & hmask;
+        in_type inn = in;
+        for(size_t i=0; i<rounds; ++i){
+            size_t r = forward ? i : rounds-1-i;
+            array<typename prf::output_value_type, prf::output_count> out;
+            inn[0] = forward ? R : L;
+            inn[1] = r;
+            prf{}(ranges::begin(inn), ranges::begin(out));
+            uint64_t F = out[0] & hmask;
+            if(forward){
+                uint64_t newR = L ^ F;
+                L = R;
+                R = newR;
+            }else{
+                uint64_t newL = R ^ F;
+                R = L;
+                L = newL;
+            }
+        }
+        return (L << h) | R;
+    }
+
+    // Apply the forward Feistel rounds to the m values in x[],
+    // calling the prf's bulk generate once per round.
+    void feistel_batch(uint64_t* x, size_t m) const{
+        array<uint64_t, batch_size> L, R;
+        for(size_t j=0; j<m; ++j){
+            L[j] = x[j] >> h;
+            R[j] = x[j] & hmask;
+        }
+        array<in_type, batch_size> inns;
+        array<typename prf::output_value_type, batch_size*prf::output_count> out;
+        auto inrange = ranges::views::iota(size_t(0), m) |
+                       ranges::views::transform([&inns](size_t j){ return ranges::begin(inns[j]); });
+        for(size_t j=0; j<m; ++j)
+            inns[j] = in;
+        for(size_t r=0; r<rounds; ++r){
+            for(size_t j=0; j<m; ++j){
+                inns[j][0] = R[j];
+                inns[j][1] = r;
+            }
+            prf{}.generate(inrange, out.data());
+            for(size_t j=0; j<m; ++j){
+                uint64_t newR = L[j] ^ (out[j*prf::output_count] & hmask);
+                L[j] = R[j];
+                R[j] = newR;
+            }
+        }
+        for(size_t j=0; j<m; ++j)
+            x[j] = (L[j] << h) | R[j];
+    }
+
+public:
+    counter_based_permutation() = default;
+
+    // The key range is copied into in[2], in[3], ... (missing values
+    // are zero), just as counter_based_engine::seed(InRange) copies
+    // its argument after the counter.
+    template <detail::integral_input_range InRange>
+    counter_based_permutation(uint64_t n_, InRange key) : n(n_){
+        unsigned bits = bit_width(n ? n-1 : 0);
+        h = std::max(1u, (bits+1)/2);
+        hmask = (uint64_t(1) << h) - 1;
+        auto kp = ranges::begin(key);
+        auto ke = ranges::end(key);
+        for(size_t i=2; i<prf::input_count; ++i)
+            in[i] = (kp == ke) ? 0 : input_value_type(*kp++) & in_mask;
+    }
+    template <integral T>
+    counter_based_permutation(uint64_t n_, initializer_list<T> key) :
+        counter_based_permutation(n_, ranges::subrange(key))
+    {}
+
+    uint64_t size() const { return n; }
+
+    // Requires i < size().
+    uint64_t permute(uint64_t i) const{
+        do{
+            i = feistel<true>(i);
+        }while(i >= n);
+        return i;
+    }
+
+    // Requires j < size().
+    uint64_t inverse(uint64_t j) const{
+        do{
+            j = feistel<false>(j);
+        }while(j >= n);
+        return j;
+    }
+
+    // Write permute(i) for i in [first, last) to out.  Indices are
+    // processed in batches, so that the prf's (possibly simd) bulk
+    // generate computes each round for the whole batch at once.  Values
+    // that need another cycle-walking step are compacted and re-run
+    // together.
+    template <weakly_incrementable O>
+    requires indirectly_writable<O, uint64_t>
+    O permute(uint64_t first, uint64_t last, O out) const{
+        array<uint64_t, batch_size> x;     // values in flight
+        array<uint8_t, batch_size> slot;   // x[k] belongs in result[slot[k]]
+        array<uint64_t, batch_size> result;
+        while(first < last){
+            size_t m = std::min<uint64_t>(batch_size, last - first);
+            for(size_t j=0; j<m; ++j){
+                x[j] = first + j;
+                slot[j] = j;
+            }
+            for(size_t todo = m; todo; ){
+                feistel_batch(x.data(), todo);
+                size_t keep = 0;
+                for(size_t k=0; k<todo; ++k){
+                    if(x[k] < n){
+                        result[slot[k]] = x[k];
+                    }else{
+                        x[keep] = x[k];
+                        slot[keep++] = slot[k];
+                    }
+                }
+                todo = keep;
+            }
+            for(size_t j=0; j<m; ++j)
+                *out++ = result[j];
+            first += m;
+        }
+        return out;
+    }
+};
+
+} // namespace std
@@ -0,0 +1,142 @@
+#pragma once
+
+// counter_based_view<prf, c> - a random_access_range and sized_range
+// over the sequence of values that a counter_based_engine<prf, c>
+// would produce.  I.e.,
+//
+//     counter_based_view<prf, c> v(key, count, first);
+//
+// is a view of 'count' values, starting with the first'th value
+// produced by counter_based_engine<prf, c>(key).  v[i] is computed on
+// demand, by calling the prf once for the block that contains it.
+// Each iterator caches the most recently computed block, so
+// sequential traversal costs one prf call per prf::output_count
+// values.
+//
+// Each iterator holds its own copy of the key, so iterators stay valid
+// after the view they came from is gone (it's a borrowed_range, like
+// iota_view), and they carry no shared, mutable state, so any
+// sub-range can be handed to a different thread, e.g.,
+//
+//     counter_based_view<philox4x64_prf, 1> v({K}, N);
+//     std::transform(std::execution::par, v.begin(), v.end(), out, f);
+//
+// Like iota_view, the iterators return values, not references.  Unlike
+// iota_view, they nevertheless claim the random_access_iterator_tag,
+// so that the parallel algorithms will split them.  Don't take the
+// address of *it.
+
+#include "detail.hpp"
+#include <array>
+#include <cstdint>
+#include <iterator>
+#include <ranges>
+#include <initializer_list>
+
+namespace std{
+
+template<typename prf, size_t c>
+class counter_based_view : public ranges::view_interface<counter_based_view<prf, c>>{
+    static_assert(c > 0);
+public:
+    using result_type = prf::output_value_type;
+    using size_type = uint64_t;
+    static constexpr size_t counter_count = c;
+private:
+    static constexpr size_t result_count = prf::output_count;
+    static constexpr size_t input_count = prf::input_count;
+    static constexpr size_t input_word_size = prf::input_word_size;
+    using input_value_type = prf::input_value_type;
+    using in_type = array<input_value_type, input_count>;
+    using prf_result_type = array<result_type, result_count>;
+    using counter_type = detail::uint_fast<c*prf::input_word_size>;
+    static constexpr auto in_mask = detail::fffmask<input_value_type, prf::input_word_size>;
+
+    // The key, in the same slots that counter_based_engine::seed(InRange)
+    // puts it.  Every iterator gets a copy of it, whose first c slots
+    // it fills with the counter.
+    in_type in{};
+    size_type first = 0;
+    size_type count = 0;
+
+public:
+    class iterator{
+        in_type in{};
+        size_type pos = 0;
+        mutable counter_type cached_ctr = 0;
+        mutable bool cached = false;
+        mutable prf_result_type block;
+
+        friend class counter_based_view;
+        iterator(const in_type& in_, size_type pos_) : in(in_), pos(pos_){}
+
+        void fill_block(counter_type ctr) const{
+            in_type inn = in;
+            for(size_t i=0; i<counter_count; ++i)
+                inn[i] = (ctr >> (input_word_size*i)) & in_mask;
+            prf{}(ranges::begin(inn), ranges::begin(block));
+            cached_ctr = ctr;
+            cached = true;
+        }
+    public:
+        using iterator_concept = random_access_iterator_tag;
+        using iterator_category = random_access_iterator_tag; // see comment at top
+        using value_type = result_type;
+        using difference_type = ptrdiff_t;
+        using reference = result_type;
+
+        iterator() = default;
+
+        result_type operator*() const{
+            counter_type ctr = pos/result_count;
+            if(!cached || ctr != cached_ctr)
+                fill_block(ctr);
+            return block[pos%result_count];
+        }
+        result_type operator[](difference_type n) const{ return *(*this + n); }
+
+        iterator& operator++(){ ++pos; return *this; }
+        iterator operator++(int){ auto ret = *this; ++pos; return ret; }
+        iterator& operator--(){ --pos; return *this; }
+        iterator operator--(int){ auto ret = *this; --pos; return ret; }
+        iterator& operator+=(difference_type n){ pos += n; return *this; }
+        iterator& operator-=(difference_type n){ pos -= n; return *this; }
+        friend iterator operator+(iterator it, difference_type n){ return it += n; }
+        friend iterator operator+(difference_type n, iterator it){ return it += n; }
+        friend iterator operator-(iterator it, difference_type n){ return it -= n; }
+        friend difference_type operator-(const iterator& a, const iterator& b){
+            return difference_type(a.pos - b.pos);
+        }
+
+        // Comparisons only look at the position, not at the cache.
+        friend bool operator==(const iterator& a, const iterator& b){ return a.pos == b.pos; }
+        friend auto operator<=>(const iterator& a, const iterator& b){ return a.pos <=> b.pos; }
+    };
+
+    counter_based_view() = default;
+
+    // The key range is treated exactly like the argument of
+    // counter_based_engine::seed(InRange).
+    template <detail::integral_input_range InRange>
+    counter_based_view(InRange key, size_type count_, size_type first_ = 0) :
+        first(first_), count(count_)
+    {
+        auto kp = ranges::begin(key);
+        auto ke = ranges::end(key);
+        for(size_t i=counter_count; i<input_count; ++i)
+            in[i] = (kp == ke) ? 0 : input_value_type(*kp++) & in_mask;
+    }
+    template <integral T>
+    counter_based_view(initializer_list<T> key, size_type count_, size_type first_ = 0) :
+        counter_based_view(ranges::subrange(key), count_, first_)
+    {}
+
+    iterator begin() const { return iterator(in, first); }
+    iterator end() const { return iterator(in, first + count); }
+    size_type size() const { return count; }
+};
+
+template <typename prf, size_t c>
+inline constexpr bool ranges::enable_borrowed_range<counter_based_view<prf, c>> = true;
+
+} // namespace std
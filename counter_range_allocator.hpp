@@ -0,0 +1,206 @@
+#pragma once
+
+// counter_range_allocator - hands out disjoint ranges of one stream's
+// value indices to cooperating processes on the same host.  The state
+// lives in a small POSIX shared-memory segment, named like a file:
+//
+//     counter_range_allocator alloc("/mysim-stream-7", tag);
+//     uint64_t first = alloc.reserve(n);   // [first, first+n) is ours
+//
+// shm_counter_based_engine<prf, c> wraps one, together with a key, as
+// a process-local engine.  It reserves 'chunk' values at a time and
+// delivers them exactly as compact_counter_based_engine<prf, c> with
+// the same key would deliver values [first, first+chunk).  So the
+// values drawn by all the processes are disjoint pieces of the same
+// stream:
+//
+//     shm_counter_based_engine<philox4x64_prf, 1> eng("/mysim-stream-7", {key});
+//     eng(b, e);
+//
+// As with the compact engine, bulk calls are the efficient way to use
+// it;  operator()() computes a whole block for every value.
+//
+// The segment holds two 64-bit words:  a stamp, identifying the stream
+// (the tag, or for the engine, a hash of the prf's shape and the key),
+// and the index of the next unreserved value.  Both are only ever
+// changed by a single atomic instruction (a compare-exchange of the
+// stamp from zero, and a fetch_add of the index), and a freshly created
+// segment is all zeros, which is a valid state.  There's no lock and no
+// multi-step initialization, so a process that dies at any point leaves
+// the segment consistent, and the survivors, or a restarted process,
+// just attach and carry on.
+//
+// A dead process's reserved but unused values are *not* handed out
+// again:  the allocator can't know which of them were already used, and
+// disjointness matters more than density.  Neither are the unused
+// values of an engine's last range when it's destroyed.  Use a smaller
+// chunk if that's too wasteful.
+//
+// The segment persists until counter_range_allocator::remove(name) (or
+// a reboot), so a stream can be continued by a later run.  Only
+// processes on one host can share it, and the stamp is a 64-bit hash:
+// it catches mistakes, not malice.
+
+#include "compact_counter_based_engine.hpp"
+#include <atomic>
+#include <cstdint>
+#include <initializer_list>
+#include <iterator>
+#include <ranges>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace std{
+
+class counter_range_allocator{
+    struct segment{
+        uint64_t stamp;   // zero until the first process attaches
+        uint64_t next;    // the index of the next unreserved value
+    };
+    static_assert(atomic_ref<uint64_t>::is_always_lock_free,
+                  "the shared words must be lock-free to be usable across processes");
+    segment* seg = nullptr;
+
+    static void fail(const char* what){
+        throw system_error(errno, generic_category(), string("counter_range_allocator: ") + what);
+    }
+    // Never zero, so that zero can mean 'unclaimed'.
+    static uint64_t stamp_of(uint64_t tag){
+        tag ^= tag >> 33;
+        tag *= 0xff51afd7ed558ccdull;
+        tag ^= tag >> 33;
+        return tag | 1;
+    }
+
+public:
+    // Open, or create, the segment 'name' for the stream identified by
+    // 'tag'.  Throws invalid_argument if the segment is already in use
+    // for a different tag, and system_error if the OS calls fail.
+    counter_range_allocator(const string& name, uint64_t tag){
+        int fd = shm_open(name.c_str(), O_RDWR | O_CREAT, 0600);
+        if(fd < 0)
+            fail("shm_open");
+        // Whoever gets here first sizes it.  Extending with ftruncate
+        // zero-fills, so racing creators agree, and nobody can map a
+        // segment that's too short.
+        struct stat st;
+        if(fstat(fd, &st) < 0 ||
+           (st.st_size < off_t(sizeof(segment)) && ftruncate(fd, sizeof(segment)) < 0)){
+            int e = errno;
+            close(fd);
+            errno = e;
+            fail("sizing the segment");
+        }
+        void* p = mmap(nullptr, sizeof(segment), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        int e = errno;
+        close(fd);
+        errno = e;
+        if(p == MAP_FAILED)
+            fail("mmap");
+        seg = static_cast<segment*>(p);
+        uint64_t expected = 0;
+        uint64_t s = stamp_of(tag);
+        if(!atomic_ref(seg->stamp).compare_exchange_strong(expected, s, memory_order_relaxed) &&
+           expected != s){
+            munmap(seg, sizeof(segment));
+            seg = nullptr;
+            throw invalid_argument("counter_range_allocator:  " + name + " belongs to a different stream");
+        }
+    }
+    counter_range_allocator(const counter_range_allocator&) = delete;
+    counter_range_allocator& operator=(const counter_range_allocator&) = delete;
+    ~counter_range_allocator(){
+        if(seg)
+            munmap(seg, sizeof(segment));
+    }
+
+    // Reserve n values.  Returns the index of the first.
+    uint64_t reserve(uint64_t n){
+        return atomic_ref(seg->next).fetch_add(n, memory_order_relaxed);
+    }
+    // How many values have been reserved, by all processes, so far.
+    uint64_t reserved() const{
+        return atomic_ref(seg->next).load(memory_order_relaxed);
+    }
+
+    // Remove the segment.  Processes that have it open keep working,
+    // but later attaches start a new stream from zero.
+    static void remove(const string& name){
+        if(shm_unlink(name.c_str()) < 0 && errno != ENOENT)
+            fail("shm_unlink");
+    }
+};
+
+template <typename prf, size_t c>
+class shm_counter_based_engine{
+    using local_type = compact_counter_based_engine<prf, c>;
+    static_assert(c*prf::input_word_size <= 64, "value indices must fit in the shared 64-bit word");
+
+    local_type proto;   // the key, with the counter at zero
+    local_type cur;     // positioned at the next value of the current range
+    uint64_t left = 0;  // values remaining in the current range
+    uint64_t chunk;
+    counter_range_allocator alloc;
+
+    template <typename R>
+    static uint64_t tag_of(const R& key){
+        // The prf's shape and the key, so that a different stream can't
+        // attach by mistake.
+        uint64_t h = prf::input_count*1000003 + prf::input_word_size*1009 + prf::output_count*31 + c;
+        for(auto k : key)
+            h = (h ^ uint64_t(k)) * 0x9e3779b97f4a7c15ull;
+        return h;
+    }
+    void refill(){
+        cur = proto;
+        cur.discard(alloc.reserve(chunk));
+        left = chunk;
+    }
+
+public:
+    using result_type = local_type::result_type;
+    using prf_type = prf;
+    static constexpr result_type min(){ return local_type::min(); }
+    static constexpr result_type max(){ return local_type::max(); }
+    static constexpr uint64_t default_chunk = 1 << 16;
+
+    template <detail::integral_input_range InRange>
+    shm_counter_based_engine(const string& name, InRange key, uint64_t chunk_ = default_chunk) :
+        proto(key), chunk(chunk_ ? chunk_ : 1), alloc(name, tag_of(key)){}
+    template <integral T>
+    shm_counter_based_engine(const string& name, initializer_list<T> key, uint64_t chunk_ = default_chunk) :
+        shm_counter_based_engine(name, ranges::subrange(key), chunk_){}
+    shm_counter_based_engine(const shm_counter_based_engine&) = delete;
+    shm_counter_based_engine& operator=(const shm_counter_based_engine&) = delete;
+
+    result_type operator()(){
+        if(left == 0)
+            refill();
+        --left;
+        return cur();
+    }
+
+    template <output_iterator<const result_type&> O, sized_sentinel_for<O> S>
+    O operator()(O out, S sen){
+        auto n = sen - out;
+        while(n > 0){
+            if(left == 0)
+                refill();
+            auto m = std::min<uint64_t>(n, left);
+            out = cur(counted_iterator(out, m), default_sentinel).base();
+            left -= m;
+            n -= m;
+        }
+        return out;
+    }
+
+    const counter_range_allocator& allocator() const { return alloc; }
+};
+
+} // namespace std
@@ -6,10 +6,34 @@
 //   fffmask<Uint, w> - the Uint with the low w bits set
 //   mulhilo<w, Uint> -> pair<U, U> - returns the w hi
 //       and w low bits of the 2w-bit product of a and b.
+//   simd_vec<T, bytes>::type - a gcc vector of T that is 'bytes' wide.
+//   parallel_for(nitems, threads, work) - calls work(i, t) for i in
+//       [0, nitems) on a few threads, with t the thread's index.
+//
+// and, outside the detail namespace, because callers need to name it:
+//
+//   unordered_results - a tag that asks for bulk results in whatever
+//       order is fastest.  See threefry_prf::generate and
+//       counter_based_engine::fill_unordered.
+//   kernel_variant{b} - a tag that asks a prf's generate for a specific
+//       implementation, e.g., threefry_prf's b-byte simd kernel.  See
+//       autotune.hpp.
 
 #pragma once
+#include <algorithm>
+#include <atomic>
 #include <concepts>
+#include <exception>
 #include <iterator>
+#include <thread>
+#include <vector>
+
+// The width of the simd vectors used by the prfs' bulk generate
+// methods.  Set PRF_SIMD_SIZE_BYTES to 0 to completely turn off SIMD.
+#ifndef PRF_SIMD_SIZE_BYTES
+// N.B. 32 bytes <-> AVX2, 64 bytes <-> AVX512
+#define PRF_SIMD_SIZE_BYTES 64
+#endif
 
 namespace std{
 namespace detail{
@@ -58,5 +82,66 @@ template <std::unsigned_integral U, unsigned w>
 requires (w <= std::numeric_limits<U>::digits)
 constexpr U fffmask = w ? (U(~(U(0))) >> (std::numeric_limits<U>::digits - w)) : 0;
 
+// N.B.  vector_size is a *non-standard* gcc extension.  The
+// attribute is silently dropped from an alias-declaration with a
+// dependent type, but it survives in a typedef inside a class
+// template.
+template <typename T, size_t bytes>
+struct simd_vec{
+    typedef T type __attribute__((vector_size(bytes)));
+};
+
+// parallel_threads(nitems, threads) - the number of threads that
+// parallel_for(nitems, threads, work) uses:  threads, or
+// hardware_concurrency() if threads is zero, but no more than nitems.
+inline unsigned parallel_threads(size_t nitems, unsigned threads){
+    unsigned n = threads ? threads : std::max(1u, thread::hardware_concurrency());
+    return unsigned(std::min<size_t>(n, nitems));
+}
+
+// parallel_for(nitems, threads, work) - call work(i, t) for every i
+// in [0, nitems), on parallel_threads(nitems, threads) threads, of
+// which the caller is one.  t, in [0, parallel_threads(...)), is the
+// calling thread's index, e.g., for per-thread scratch.  The threads
+// claim items one at a time, with an atomic fetch_add.  If work
+// throws, the other threads stop at their next item, and the lowest
+// numbered thread's exception is rethrown after they've all finished.
+template <typename F>
+void parallel_for(size_t nitems, unsigned threads, F work){
+    const unsigned nthreads = parallel_threads(nitems, threads);
+    atomic<size_t> next{0};
+    vector<exception_ptr> errors(nthreads);
+    auto run = [&](unsigned t){
+        try{
+            for(size_t i; (i = next.fetch_add(1, memory_order_relaxed)) < nitems; )
+                work(i, t);
+        }catch(...){
+            errors[t] = current_exception();
+            next.store(nitems, memory_order_relaxed);
+        }
+    };
+    vector<thread> pool;
+    for(unsigned t=1; t<nthreads; ++t)
+        pool.emplace_back(run, t);
+    if(nthreads)
+        run(0);
+    for(auto& th : pool)
+        th.join();
+    for(auto& e : errors)
+        if(e)
+            rethrow_exception(e);
+}
+
 } // namespace detail
+
+struct unordered_results_t{
+    explicit unordered_results_t() = default;
+};
+inline constexpr unordered_results_t unordered_results{};
+
+struct kernel_variant{
+    size_t simd_bytes;
+    constexpr explicit kernel_variant(size_t b) : simd_bytes(b){}
+};
+
 } // namespace std
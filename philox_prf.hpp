@@ -1,6 +1,7 @@
 #pragma once
 
 #include "detail.hpp" // a couple of helpful functions and concepts
+#include "prf_counters.hpp"
 #include <array>
 #include <ranges>
 
@@ -43,6 +44,7 @@ public:
         // InputIterators.  Each InputIterator will be dereferenced
         // exactly 3*n/2 times.
         static_assert(is_integral_v<iter_value_t<ranges::range_value_t<InRange>>>);
+        detail::instrument([&](auto& ctrs){ ctrs.prf_blocks += ranges::size(inrange); });
         for(auto initer : inrange){
             if constexpr (n == 2){
                 input_value_type R0 = (*initer++) & inmask;
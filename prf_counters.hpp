@@ -0,0 +1,216 @@
+#pragma once
+
+// Opt-in instrumentation for counter_based_engine and the prfs.
+//
+// If PRF_INSTRUMENT is defined to a non-zero value (e.g., with
+// -DPRF_INSTRUMENT=1), the engines and prfs count what they do in
+// per-thread counters.  Otherwise, the counting code isn't even
+// instantiated, and the snapshot functions below return zeros.
+// PRF_INSTRUMENT must have the same value in every translation unit
+// of a program.
+//
+// The counters are:
+//
+//   prf_blocks - blocks computed by any prf's operator() or generate.
+//   scalar_values - values delivered by an engine's operator()().
+//   bulk_calls, bulk_values - calls to, and values delivered by,
+//       an engine's operator()(b, e) or fill_unordered.
+//   bulk_size_log2[k] - bulk calls that asked for n values, with
+//       bit_width(n) == k.
+//   generate_values - values written by the prf's generate directly
+//       into a bulk call's output range,
+//   staged_values - or via the staging buffer (non-contiguous outputs,
+//       and for_each_block with a prf that has no for_each_block).
+//   fused_values - values passed to an engine's for_each_block callback
+//       directly by the prf's for_each_block.
+//   saved_values - values delivered from results that were saved
+//       by an earlier call.
+//   refills - times an engine refilled its saved results.
+//   straggler_values - values delivered directly from a refill.
+//   discard_calls, discarded_values - calls to discard, and the sum
+//       of their arguments.
+//   wasted_values - values that were computed by the prf but never
+//       delivered, because discard skipped over them.
+//   bytes - bytes delivered by engines (word_size/8 per value).
+//
+// The snapshot/export API:
+//
+//   prf_counters_this_thread() - the calling thread's counters.
+//   prf_counters_all_threads() - the sum over all threads, including
+//       those that have exited.  Other threads' counters are read
+//       without stopping them, so the total is only approximate while
+//       they're running.
+//   prf_counters supports +=, -= (for measuring an interval), visit
+//   and operator<<, which writes one 'name value' line per counter.
+
+#ifndef PRF_INSTRUMENT
+#define PRF_INSTRUMENT 0
+#endif
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <ostream>
+#include <string>
+#if PRF_INSTRUMENT
+#include <algorithm>
+#include <mutex>
+#include <vector>
+#endif
+
+namespace std{
+
+template <typename T>
+struct basic_prf_counters{
+    T prf_blocks{};
+    T scalar_values{};
+    T bulk_calls{};
+    T bulk_values{};
+    array<T, 65> bulk_size_log2{};
+    T generate_values{};
+    T staged_values{};
+    T fused_values{};
+    T saved_values{};
+    T refills{};
+    T straggler_values{};
+    T discard_calls{};
+    T discarded_values{};
+    T wasted_values{};
+    T bytes{};
+
+    // Call f(name, counter, other_counter) for every counter in
+    // *this, and the corresponding counter in other.
+    template <typename Other, typename F>
+    void visit(Other& other, F f){
+        f("prf_blocks", prf_blocks, other.prf_blocks);
+        f("scalar_values", scalar_values, other.scalar_values);
+        f("bulk_calls", bulk_calls, other.bulk_calls);
+        f("bulk_values", bulk_values, other.bulk_values);
+        for(size_t k=0; k<bulk_size_log2.size(); ++k)
+            f("bulk_size_log2[" + to_string(k) + "]", bulk_size_log2[k], other.bulk_size_log2[k]);
+        f("generate_values", generate_values, other.generate_values);
+        f("staged_values", staged_values, other.staged_values);
+        f("fused_values", fused_values, other.fused_values);
+        f("saved_values", saved_values, other.saved_values);
+        f("refills", refills, other.refills);
+        f("straggler_values", straggler_values, other.straggler_values);
+        f("discard_calls", discard_calls, other.discard_calls);
+        f("discarded_values", discarded_values, other.discarded_values);
+        f("wasted_values", wasted_values, other.wasted_values);
+        f("bytes", bytes, other.bytes);
+    }
+    // Call f(name, counter) for every counter.
+    template <typename F>
+    void visit(F f){
+        visit(*this, [&](const string& name, T& v, T&){ f(name, v); });
+    }
+};
+
+struct prf_counters : basic_prf_counters<uint64_t>{
+    prf_counters& operator+=(const prf_counters& rhs){
+        visit(rhs, [](auto&&, uint64_t& v, uint64_t r){ v += r; });
+        return *this;
+    }
+    prf_counters& operator-=(const prf_counters& rhs){
+        visit(rhs, [](auto&&, uint64_t& v, uint64_t r){ v -= r; });
+        return *this;
+    }
+    friend prf_counters operator+(prf_counters a, const prf_counters& b){ return a += b; }
+    friend prf_counters operator-(prf_counters a, const prf_counters& b){ return a -= b; }
+
+    // One line per counter.  Empty histogram buckets are omitted.
+    template <typename CharT, typename Traits>
+    friend basic_ostream<CharT, Traits>& operator<<(basic_ostream<CharT, Traits>& os, prf_counters c){
+        c.visit([&](const string& name, uint64_t v){
+                    if(v || name.find('[') == string::npos)
+                        os << name.c_str() << " " << v << "\n";
+                });
+        return os;
+    }
+};
+
+namespace detail{
+
+// A counter that's only ever modified by its owning thread, but that
+// other threads may read.  Relaxed loads and stores are enough, and
+// they compile to plain loads and stores.
+struct relaxed_counter{
+    atomic<uint64_t> v{0};
+    void operator+=(uint64_t n){
+        v.store(v.load(memory_order_relaxed) + n, memory_order_relaxed);
+    }
+    uint64_t load() const { return v.load(memory_order_relaxed); }
+};
+
+#if PRF_INSTRUMENT
+struct thread_prf_counters;
+
+struct prf_counter_registry{
+    mutex m;
+    prf_counters exited; // the sum over threads that have exited
+    vector<thread_prf_counters*> live;
+};
+inline prf_counter_registry& counter_registry(){
+    static prf_counter_registry r;
+    return r;
+}
+
+struct thread_prf_counters : basic_prf_counters<relaxed_counter>{
+    thread_prf_counters(){
+        auto& r = counter_registry();
+        lock_guard<mutex> lg(r.m);
+        r.live.push_back(this);
+    }
+    ~thread_prf_counters(){
+        auto& r = counter_registry();
+        lock_guard<mutex> lg(r.m);
+        r.exited += snapshot();
+        r.live.erase(find(r.live.begin(), r.live.end(), this));
+    }
+    prf_counters snapshot(){
+        prf_counters ret;
+        ret.visit(*this, [](auto&&, uint64_t& v, const relaxed_counter& c){ v = c.load(); });
+        return ret;
+    }
+};
+
+inline thread_prf_counters& this_thread_counters(){
+    thread_local thread_prf_counters c;
+    return c;
+}
+#endif
+
+// The instrumentation hook.  E.g.,
+//    detail::instrument([&](auto& ctrs){ ctrs.refills += 1; });
+// When PRF_INSTRUMENT is off, f is never instantiated.
+template <typename F>
+[[gnu::always_inline]] inline void instrument([[maybe_unused]] F f){
+#if PRF_INSTRUMENT
+    f(this_thread_counters());
+#endif
+}
+
+} // namespace detail
+
+inline prf_counters prf_counters_this_thread(){
+#if PRF_INSTRUMENT
+    return detail::this_thread_counters().snapshot();
+#else
+    return {};
+#endif
+}
+
+inline prf_counters prf_counters_all_threads(){
+#if PRF_INSTRUMENT
+    auto& r = detail::counter_registry();
+    lock_guard<mutex> lg(r.m);
+    prf_counters ret = r.exited;
+    for(auto p : r.live)
+        ret += p->snapshot();
+    return ret;
+#else
+    return {};
+#endif
+}
+
+} // namespace std
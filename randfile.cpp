@@ -0,0 +1,149 @@
+// randfile - create, regenerate or check a file of reproducible random
+// bytes.  See random_file.hpp for what's in the file.
+//
+// Usage:
+//   randfile [options] FILE SIZE         - create FILE, SIZE bytes long
+//   randfile -o OFFSET [options] FILE N  - rewrite bytes [OFFSET, OFFSET+N)
+//                                          of FILE, leaving the rest alone
+//   randfile -c [-o OFFSET] FILE N       - check bytes [OFFSET, OFFSET+N)
+// Options:
+//   -k KEY[,KEY...]  the engine's key words (default 0)
+//   -g GEN           threefry4x64 (the default), philox4x64, squares64
+//   -t THREADS       default: all the hardware threads
+//   -C CHUNK         bytes per unit of work (default 64M)
+//   -p               pwrite from a buffer rather than writing through mmap
+//   -H               ask for transparent huge pages
+// Sizes may have a K, M, G or T (binary) suffix.  The file depends only
+// on the generator and key, so e.g., -t and -p don't change it.
+//
+// Exit status:  0 on success (for -c, if the bytes match), 1 on a
+// mismatch, 2 on an error.
+
+#include "random_file.hpp"
+#include "compact_counter_based_engine.hpp"
+#include "threefry_prf.hpp"
+#include "philox_prf.hpp"
+#include "squares_prf.hpp"
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+[[noreturn]] void usage(const string& why){
+    cerr << "randfile: " << why << "\n"
+         << "usage: randfile [-c] [-o OFFSET] [-k KEY[,KEY...]] [-g GEN] [-t THREADS] [-C CHUNK] [-p] [-H] FILE SIZE\n";
+    exit(2);
+}
+
+uint64_t parse_size(const string& s){
+    size_t pos;
+    uint64_t v;
+    try{
+        v = stoull(s, &pos, 0);
+    }catch(exception&){
+        usage("bad size: " + s);
+    }
+    string suffix = s.substr(pos);
+    unsigned shift = suffix == "" ? 0 : suffix == "K" ? 10 : suffix == "M" ? 20 : suffix == "G" ? 30 : suffix == "T" ? 40 : 99;
+    if(shift == 99 || (shift && v >> (64 - shift)))
+        usage("bad size: " + s);
+    return v << shift;
+}
+
+struct args{
+    string file;
+    uint64_t offset = 0, n = 0;
+    bool check = false, create = true;
+    vector<uint64_t> key;
+    random_file_options opt;
+};
+
+template <typename Eng>
+int run(const args& a){
+    if(a.key.size() > Eng::seed_count)
+        usage("too many key words for this generator");
+    Eng proto(a.key);
+    auto t0 = chrono::steady_clock::now();
+    const char* what = a.check ? "checked" : "wrote";
+    if(a.check){
+        int fd = open(a.file.c_str(), O_RDONLY);
+        if(fd < 0)
+            throw system_error(errno, generic_category(), "randfile: open " + a.file);
+        uint64_t bad = random_file_verify(fd, proto, a.offset, a.n, a.opt);
+        close(fd);
+        if(bad != UINT64_MAX){
+            cout << a.file << ": first difference at byte " << bad << "\n";
+            return 1;
+        }
+    }else if(a.create){
+        random_file_create(a.file, a.n, proto, a.opt);
+    }else{
+        int fd = open(a.file.c_str(), O_RDWR|O_CREAT, 0666);
+        if(fd < 0)
+            throw system_error(errno, generic_category(), "randfile: open " + a.file);
+        random_file_fill(fd, proto, a.offset, a.n, a.opt);
+        if(close(fd))
+            throw system_error(errno, generic_category(), "randfile: close " + a.file);
+    }
+    chrono::duration<double> dt = chrono::steady_clock::now() - t0;
+    cout << what << " " << a.n << " bytes at offset " << a.offset << " of " << a.file
+         << " in " << dt.count() << " s (" << a.n/dt.count()/1e9 << " GB/s)\n";
+    return 0;
+}
+
+int main(int argc, char** argv){
+    args a;
+    string gen = "threefry4x64";
+    vector<string> pos;
+    for(int i=1; i<argc; ++i){
+        string s = argv[i];
+        auto optarg = [&]() -> string {
+            if(i+1 >= argc)
+                usage(s + " requires an argument");
+            return argv[++i];
+        };
+        if(s == "-c")
+            a.check = true;
+        else if(s == "-o"){
+            a.offset = parse_size(optarg());
+            a.create = false;
+        }else if(s == "-k"){
+            istringstream iss(optarg());
+            for(string w; getline(iss, w, ','); )
+                a.key.push_back(parse_size(w));
+        }else if(s == "-g")
+            gen = optarg();
+        else if(s == "-t")
+            a.opt.threads = unsigned(parse_size(optarg()));
+        else if(s == "-C")
+            a.opt.chunk_bytes = parse_size(optarg());
+        else if(s == "-p")
+            a.opt.use_mmap = false;
+        else if(s == "-H")
+            a.opt.huge_pages = true;
+        else if(s.size() > 1 && s[0] == '-')
+            usage("unknown option " + s);
+        else
+            pos.push_back(s);
+    }
+    if(pos.size() != 2)
+        usage("expected FILE and SIZE");
+    a.file = pos[0];
+    a.n = parse_size(pos[1]);
+    try{
+        if(gen == "threefry4x64")
+            return run<compact_threefry4x64>(a);
+        if(gen == "philox4x64")
+            return run<compact_philox4x64>(a);
+        if(gen == "squares64")
+            return run<compact_counter_based_engine<squares64_prf, 1>>(a);
+        usage("unknown generator " + gen);
+    }catch(exception& e){
+        cerr << e.what() << "\n";
+        return 2;
+    }
+}
@@ -0,0 +1,317 @@
+#pragma once
+
+// random_file - big files of reproducible random bytes, e.g., test
+// datasets and noise files for storage and ML benchmarks:
+//
+//     compact_threefry4x64 proto({seed});
+//     random_file_create("noise.bin", 200ull<<30, proto);  // the whole file
+//     random_file_fill(fd, proto, offset, n);              // just [offset, offset+n)
+//     random_file_verify(fd, proto, offset, n);            // check [offset, offset+n)
+//     random_fill_bytes(proto, offset, buf, n);            // the same bytes, in memory
+//
+// Byte j of the file is byte j of the stream of values that 'proto',
+// an engine at the start of its sequence, would produce, with each
+// value written as word_size/8 little-endian bytes.  So the contents
+// depend only on the engine's type and key:  not on the number of
+// threads, the chunk size, mmap vs. pwrite or the host's byte order.
+// Any region can be regenerated, or checked, by itself.
+//
+// The engine must be copyable, with a cheap discard and a bulk
+// operator()(b, e), i.e., a counter_based_engine or, better, a
+// compact_counter_based_engine, whose copies are smaller.
+//
+// The region is divided into chunks of options::chunk_bytes (rounded
+// to a multiple of the page size), aligned in the file, which the
+// threads claim, one at a time, with an atomic fetch_add.  Each chunk
+// is one discard of a copy of proto and one bulk call.  With
+// options::use_mmap, a chunk's blocks are allocated with
+// posix_fallocate, it's a MAP_SHARED window of the file, the engine
+// writes straight into the page cache, and the window is written back
+// with msync(MS_SYNC).  Otherwise, it's generated into a per-thread
+// buffer and written with pwrite, and the file is fsync'ed at the
+// end.  Either way, a full disk or a write error is reported
+// (not a SIGBUS, or a silently lost page).
+// options::huge_pages asks for transparent huge pages
+// (madvise(MADV_HUGEPAGE)) for the windows or buffers.  It's only a
+// hint:  it's silently ignored where the kernel or filesystem can't
+// use it.
+//
+// Errors throw system_error.  If a thread fails, the others stop at
+// their next chunk, and the first error is rethrown.  The region's
+// contents are then unspecified.
+
+#include "detail.hpp"
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <system_error>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace std{
+
+struct random_file_options{
+    unsigned threads = 0;           // 0 means thread::hardware_concurrency()
+    uint64_t chunk_bytes = 64<<20;  // the unit of work, and the mmap window
+    bool use_mmap = true;           // false means pwrite from a buffer
+    bool huge_pages = false;        // madvise(MADV_HUGEPAGE) the windows or buffers
+};
+
+namespace detail{
+
+[[noreturn]] inline void random_file_fail(const char* what, int err = errno){
+    throw system_error(err, generic_category(), string("random_file: ") + what);
+}
+
+// Write the low vbytes bytes of v to p, little-endian.
+template <size_t vbytes, typename T>
+void store_le(T v, unsigned char* p){
+    for(size_t i=0; i<vbytes; ++i)
+        p[i] = (unsigned char)(v >> (8*i));
+}
+
+inline void random_file_advise(void* p, size_t len, const random_file_options& opt){
+#ifdef MADV_HUGEPAGE
+    if(opt.huge_pages)
+        madvise(p, len, MADV_HUGEPAGE);
+#endif
+}
+
+// A MAP_SHARED window of fd covering [lo, hi).  lo must be page
+// aligned.
+class file_window{
+    void* base = MAP_FAILED;
+    size_t len = 0;
+public:
+    file_window(int fd, uint64_t lo, uint64_t hi, int prot, const random_file_options& opt) :
+        len(hi - lo)
+    {
+        base = mmap(nullptr, len, prot, MAP_SHARED, fd, off_t(lo));
+        if(base == MAP_FAILED)
+            random_file_fail("mmap");
+        random_file_advise(base, len, opt);
+    }
+    file_window(const file_window&) = delete;
+    file_window& operator=(const file_window&) = delete;
+    ~file_window(){ munmap(base, len); }
+    unsigned char* data() const { return static_cast<unsigned char*>(base); }
+    // Write the window back, and report any error.
+    void sync() const{
+        if(msync(base, len, MS_SYNC))
+            random_file_fail("msync");
+    }
+};
+
+// An anonymous mapping, for the pwrite and verify buffers, so that it
+// can be given huge pages.
+class anon_buffer{
+    void* base = MAP_FAILED;
+    size_t len = 0;
+public:
+    anon_buffer(size_t len_, const random_file_options& opt) : len(len_){
+        base = mmap(nullptr, len, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+        if(base == MAP_FAILED)
+            random_file_fail("mmap");
+        random_file_advise(base, len, opt);
+    }
+    anon_buffer(const anon_buffer&) = delete;
+    anon_buffer& operator=(const anon_buffer&) = delete;
+    ~anon_buffer(){ munmap(base, len); }
+    unsigned char* data() const { return static_cast<unsigned char*>(base); }
+};
+
+inline uint64_t random_file_chunk(const random_file_options& opt){
+    const uint64_t page = sysconf(_SC_PAGESIZE);
+    return std::max(page, opt.chunk_bytes/page*page);
+}
+
+// Call work(lo, hi, scratch) for every chunk-aligned piece [lo, hi) of
+// [offset, offset+n), on opt.threads threads.  scratch is a per-thread
+// buffer of scratch_bytes, or null if scratch_bytes is zero.
+template <typename F>
+void random_file_parallel(uint64_t offset, uint64_t n, size_t scratch_bytes,
+                          const random_file_options& opt, F work){
+    if(n == 0)
+        return;
+    const uint64_t chunk = random_file_chunk(opt);
+    const uint64_t first = offset/chunk;
+    const uint64_t nchunks = (offset + n - 1)/chunk + 1 - first;
+    // Each thread's scratch is allocated by the thread itself, when it
+    // claims its first chunk.
+    vector<unique_ptr<anon_buffer>> scratch(parallel_threads(nchunks, opt.threads));
+    parallel_for(nchunks, opt.threads, [&](size_t i, unsigned t){
+        if(scratch_bytes && !scratch[t])
+            scratch[t] = make_unique<anon_buffer>(scratch_bytes, opt);
+        const uint64_t k = first + i;
+        uint64_t lo = std::max(offset, k*chunk);
+        uint64_t hi = std::min(offset + n, (k+1)*chunk);
+        work(lo, hi, scratch[t] ? scratch[t]->data() : nullptr);
+    });
+}
+
+} // namespace detail
+
+// Write bytes [offset, offset+n) of proto's byte stream to out.
+template <typename Eng>
+void random_fill_bytes(const Eng& proto, uint64_t offset, void* out, size_t n){
+    using result_type = typename Eng::result_type;
+    constexpr size_t vbytes = Eng::word_size/8;
+    static_assert(Eng::word_size%8 == 0 && vbytes <= sizeof(result_type));
+    auto p = static_cast<unsigned char*>(out);
+    Eng e = proto;
+    e.discard(offset/vbytes);
+    // The end of a value that starts before offset.
+    if(size_t skip = offset%vbytes; skip && n){
+        unsigned char b[vbytes];
+        detail::store_le<vbytes>(e(), b);
+        size_t m = std::min(n, vbytes - skip);
+        memcpy(p, b + skip, m);
+        p += m;
+        n -= m;
+    }
+    size_t nv = n/vbytes;
+    // Whole values, directly, if they're already in the right form,
+    // or through a small buffer.
+    if constexpr (endian::native == endian::little && sizeof(result_type) == vbytes){
+        if(reinterpret_cast<uintptr_t>(p)%alignof(result_type) == 0){
+            auto r = reinterpret_cast<result_type*>(p);
+            e(r, r + nv);
+            p += nv*vbytes;
+            nv = 0;
+        }
+    }
+    while(nv){
+        array<result_type, 512> buf;
+        size_t m = std::min(nv, buf.size());
+        e(buf.begin(), buf.begin() + m);
+        for(size_t i=0; i<m; ++i, p += vbytes)
+            detail::store_le<vbytes>(buf[i], p);
+        nv -= m;
+    }
+    // The start of a value that ends after offset+n.
+    if(size_t m = n%vbytes){
+        unsigned char b[vbytes];
+        detail::store_le<vbytes>(e(), b);
+        memcpy(p, b, m);
+    }
+}
+
+// Write bytes [offset, offset+n) of proto's byte stream to the same
+// bytes of the file open for writing on fd.  The file is extended if
+// it's shorter than offset+n.  Nothing else in it is changed.  A
+// shared mapping needs a descriptor that's open for reading, too, so
+// if fd is O_WRONLY, it's written with pwrite, whatever
+// options::use_mmap says.
+template <typename Eng>
+void random_file_fill(int fd, const Eng& proto, uint64_t offset, uint64_t n,
+                      const random_file_options& opt = {}){
+    if(n == 0)
+        return;
+    struct stat st;
+    if(fstat(fd, &st))
+        detail::random_file_fail("fstat");
+    if(uint64_t(st.st_size) < offset + n && ftruncate(fd, off_t(offset + n)))
+        detail::random_file_fail("ftruncate");
+    const uint64_t chunk = detail::random_file_chunk(opt);
+    int fl = fcntl(fd, F_GETFL);
+    if(fl < 0)
+        detail::random_file_fail("fcntl");
+    if(opt.use_mmap && (fl & O_ACCMODE) == O_RDWR){
+        detail::random_file_parallel(offset, n, 0, opt, [&](uint64_t lo, uint64_t hi, unsigned char*){
+            // Allocate the blocks first, so that running out of space
+            // is an error here rather than a SIGBUS in the stores.
+            if(int err = posix_fallocate(fd, off_t(lo), off_t(hi - lo)))
+                detail::random_file_fail("posix_fallocate", err);
+            uint64_t base = lo/chunk*chunk;
+            detail::file_window w(fd, base, hi, PROT_READ|PROT_WRITE, opt);
+            random_fill_bytes(proto, lo, w.data() + (lo - base), hi - lo);
+            w.sync();
+        });
+    }else{
+        detail::random_file_parallel(offset, n, chunk, opt, [&](uint64_t lo, uint64_t hi, unsigned char* buf){
+            random_fill_bytes(proto, lo, buf, hi - lo);
+            for(uint64_t done = 0; done < hi - lo; ){
+                ssize_t w = pwrite(fd, buf + done, hi - lo - done, off_t(lo + done));
+                if(w < 0 && errno == EINTR)
+                    continue;
+                if(w <= 0)
+                    detail::random_file_fail("pwrite");
+                done += w;
+            }
+        });
+        if(fsync(fd))
+            detail::random_file_fail("fsync");
+    }
+}
+
+// Create (or truncate) the file 'path', size bytes long, and fill it.
+template <typename Eng>
+void random_file_create(const string& path, uint64_t size, const Eng& proto,
+                        const random_file_options& opt = {}){
+    int fd = open(path.c_str(), O_RDWR|O_CREAT|O_TRUNC, 0666);
+    if(fd < 0)
+        detail::random_file_fail("open");
+    try{
+        if(ftruncate(fd, off_t(size)))
+            detail::random_file_fail("ftruncate");
+        random_file_fill(fd, proto, 0, size, opt);
+    }catch(...){
+        close(fd);
+        throw;
+    }
+    if(close(fd))
+        detail::random_file_fail("close");
+}
+
+// Check bytes [offset, offset+n) of the file open for reading on fd
+// against proto's byte stream.  Returns the offset of the first byte
+// that differs (or is missing, past the end of the file), or
+// UINT64_MAX if they all match.
+template <typename Eng>
+uint64_t random_file_verify(int fd, const Eng& proto, uint64_t offset, uint64_t n,
+                            const random_file_options& opt = {}){
+    // Each chunk is compared a window at a time, so the threads' buffers
+    // stay small whatever the chunk size.
+    const uint64_t window = std::min<uint64_t>(detail::random_file_chunk(opt), 4<<20);
+    atomic<uint64_t> bad{UINT64_MAX};
+    auto note_bad = [&](uint64_t at){
+        uint64_t b = bad.load(memory_order_relaxed);
+        while(at < b && !bad.compare_exchange_weak(b, at, memory_order_relaxed))
+            ;
+    };
+    detail::random_file_parallel(offset, n, 2*window, opt, [&](uint64_t lo, uint64_t hi, unsigned char* buf){
+        unsigned char* expected = buf + window;
+        for(uint64_t wlo = lo; wlo < hi; wlo += window){
+            const uint64_t m = std::min(window, hi - wlo);
+            random_fill_bytes(proto, wlo, expected, m);
+            uint64_t done = 0;
+            while(done < m){
+                ssize_t r = pread(fd, buf + done, m - done, off_t(wlo + done));
+                if(r < 0 && errno == EINTR)
+                    continue;
+                if(r < 0)
+                    detail::random_file_fail("pread");
+                if(r == 0)
+                    break;
+                done += r;
+            }
+            uint64_t d = std::mismatch(buf, buf + done, expected).first - buf;
+            if(d < m){
+                note_bad(wlo + d);
+                return;
+            }
+        }
+    });
+    return bad.load();
+}
+
+} // namespace std
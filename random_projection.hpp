@@ -0,0 +1,281 @@
+#pragma once
+
+// random_projection<prf> - an implicit rows x cols random matrix R,
+// e.g., for Johnson-Lindenstrauss embeddings and sketching, that's
+// never stored.  Every entry is a function of the key and (i, j), so
+// R is recomputed, tile by tile, whenever it's applied:
+//
+//     random_projection<> R({seed}, k, d, projection_kind::rademacher, 1/sqrt(k));
+//     R.apply(x, y);              // y = R x      (x has d elements, y has k)
+//     R.apply_transpose(y, x);    // x = R^T y
+//     R(i, j)                     // one entry, in O(1)
+//
+// The kinds of entries, all with mean 0 and variance scale^2:
+//
+//   gaussian   - normal, by Box-Muller, from 64 bits per pair of entries.
+//   rademacher - +-scale, equally likely, from one bit per entry.
+//   sparse     - +-scale*sqrt(s) with probability 1/(2s) each, and 0
+//                otherwise (Achlioptas's, or with s = sqrt(d), Li et
+//                al.'s "very sparse" projections), from 16 bits per
+//                entry.  1/s is rounded to a multiple of 2^-15, and
+//                the magnitude is adjusted to keep the variance exact.
+//
+// Entry (i, j) is taken from the prf block whose first two input words
+// are (j/E, i), where E is the number of entries per block, and whose
+// remaining words are the key.  The prf must have 64-bit outputs and
+// at least three input words.
+//
+// apply and apply_transpose generate tiles of R, a few rows by 512
+// columns (or E, if that's more) at a time, with one prf::generate call on a lazily
+// constructed input range (so threefry's simd kernels are used),
+// expand them into a row of doubles in L1 and consume them right away.
+// apply is split among threads by blocks of rows, and apply_transpose
+// by blocks of columns, so that each thread owns the outputs it
+// computes.  The order of the floating-point additions is fixed, so
+// the results don't depend on the number of threads.
+//
+// Each application costs one prf evaluation per E entries of R.  With
+// threefry4x64, E is 256 for rademacher, 16 for sparse and 8 for
+// gaussian, and gaussian also costs a log, a sqrt and a sincos per
+// pair of entries, so rademacher and sparse are much faster.
+
+#include "detail.hpp"
+#include "threefry_prf.hpp"
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cmath>
+#include <cstdint>
+#include <initializer_list>
+#include <numbers>
+#include <ranges>
+#include <stdexcept>
+
+namespace std{
+
+enum class projection_kind{ gaussian, rademacher, sparse };
+
+template <typename prf = threefry4x64_prf>
+class random_projection{
+    static_assert(prf::output_word_size == 64 && sizeof(typename prf::output_value_type) == 8,
+                  "random_projection needs a prf with 64-bit outputs");
+    static_assert(prf::input_count >= 3 && prf::input_word_size == 64);
+    static constexpr size_t result_count = prf::output_count;
+    static constexpr size_t input_count = prf::input_count;
+    using input_value_type = prf::input_value_type;
+    using in_type = array<input_value_type, input_count>;
+
+    // Tiles are this many columns wide, a multiple of E for every
+    // kind.
+    static constexpr size_t tile_cols = std::max<size_t>(512, 64*result_count);
+    // At most this many prf blocks are generated at a time.
+    static constexpr size_t max_blocks = 64;
+    static constexpr uint64_t sign_bit = uint64_t(1) << 63;
+
+    in_type in{};   // the key, in words 2 and up
+    size_t nrows = 0, ncols = 0;
+    projection_kind kind = projection_kind::rademacher;
+    double scale = 1.;
+    double sparse_value = 1.;   // the magnitude of sparse's nonzeros
+    uint32_t sparse_threshold = 0;
+
+    size_t entries_per_word() const{
+        switch(kind){
+        case projection_kind::gaussian: return 2;
+        case projection_kind::sparse: return 4;
+        default: return 64;
+        }
+    }
+    size_t entries_per_block() const { return entries_per_word()*result_count; }
+
+    // Generate the blocks for rows [i0, i0+ni) and columns [c0,
+    // c0+ng*E), row by row, into out.  c0 is a multiple of E.
+    void generate_rows(size_t i0, size_t ni, size_t c0, size_t ng, uint64_t* out) const{
+        const size_t g0 = c0/entries_per_block();
+        in_type inn;
+        prf{}.generate(ranges::views::iota(size_t(0), ni*ng) |
+                       ranges::views::transform([&](size_t t){
+                                                    inn = in;
+                                                    inn[0] = g0 + t%ng;
+                                                    inn[1] = i0 + t/ng;
+                                                    return ranges::begin(inn);
+                                                }),
+                       out);
+    }
+
+    // Entry k of the words at w.
+    double entry(const uint64_t* w, size_t k) const{
+        switch(kind){
+        case projection_kind::rademacher:
+            return bit_cast<double>(bit_cast<uint64_t>(scale) ^ (w[k/64] << (63 - k%64) & sign_bit));
+        case projection_kind::sparse:{
+            const uint32_t f = (w[k/4] >> (16*(k%4))) & 0xffff;
+            const uint64_t nonzero = -uint64_t((f >> 1) < sparse_threshold);
+            return bit_cast<double>((bit_cast<uint64_t>(sparse_value) ^ uint64_t(f & 1) << 63) & nonzero);
+        }
+        default:{
+            // Box-Muller on the halves of a word.  u1 is in (0, 1].
+            const double u1 = ((w[k/2] >> 32) + 1.) * 0x1p-32;
+            const double u2 = (w[k/2] & 0xffffffff) * 0x1p-32;
+            const double t = 2.*numbers::pi*u2;
+            return scale*sqrt(-2.*log(u1)) * (k%2 ? sin(t) : cos(t));
+        }
+        }
+    }
+
+    // Entries [0, n) of the words at w, to out.  The loops over whole
+    // words vectorize, except for gaussian's log, sin and cos.
+    void expand(const uint64_t* w, size_t n, double* out) const{
+        size_t k = 0;
+        switch(kind){
+        case projection_kind::rademacher:{
+            const uint64_t s = bit_cast<uint64_t>(scale);
+            for(; k+64<=n; k+=64){
+                const uint64_t wk = w[k/64];
+                for(size_t b=0; b<64; ++b)
+                    out[k+b] = bit_cast<double>(s ^ (wk << (63 - b) & sign_bit));
+            }
+            break;
+        }
+        case projection_kind::sparse:{
+            const uint64_t s = bit_cast<uint64_t>(sparse_value);
+            for(; k+4<=n; k+=4){
+                const uint64_t wk = w[k/4];
+                for(size_t b=0; b<4; ++b){
+                    const uint32_t f = (wk >> (16*b)) & 0xffff;
+                    const uint64_t nonzero = -uint64_t((f >> 1) < sparse_threshold);
+                    out[k+b] = bit_cast<double>((s ^ uint64_t(f & 1) << 63) & nonzero);
+                }
+            }
+            break;
+        }
+        case projection_kind::gaussian:
+            for(; k+2<=n; k+=2){
+                const double u1 = ((w[k/2] >> 32) + 1.) * 0x1p-32;
+                const double u2 = (w[k/2] & 0xffffffff) * 0x1p-32;
+                const double r = scale*sqrt(-2.*log(u1));
+                const double t = 2.*numbers::pi*u2;
+                out[k] = r*cos(t);
+                out[k+1] = r*sin(t);
+            }
+            break;
+        }
+        for(; k<n; ++k)
+            out[k] = entry(w, k);
+    }
+
+    // Call f(i, c0, n, entries) for each row i in [i0, i1) and each
+    // tile [c0, c0+n) of columns in [c_lo, c_hi), with R(i, c0+k) in
+    // entries[k].  Rows are visited in order, and the tiles of a row
+    // in order, row by row within each group of tiles.
+    template <typename F>
+    void for_each_tile(size_t i0, size_t i1, size_t c_lo, size_t c_hi, F f) const{
+        const size_t E = entries_per_block();
+        // Room for max_blocks blocks, or for one row of a tile at two
+        // entries per word (gaussian, with a prf that has few outputs).
+        array<uint64_t, std::max(max_blocks*result_count, tile_cols/2)> words;
+        alignas(64) array<double, tile_cols> entries;
+        for(size_t c0=c_lo; c0<c_hi; c0 += tile_cols){
+            const size_t n = std::min(tile_cols, c_hi - c0);
+            const size_t ng = (n + E - 1)/E;
+            const size_t rows_per_gen = std::max<size_t>(1, max_blocks/ng);
+            for(size_t r0=i0; r0<i1; r0 += rows_per_gen){
+                const size_t nr = std::min(rows_per_gen, i1 - r0);
+                generate_rows(r0, nr, c0, ng, words.data());
+                for(size_t r=0; r<nr; ++r){
+                    expand(words.data() + r*ng*result_count, n, entries.data());
+                    f(r0 + r, c0, n, entries.data());
+                }
+            }
+        }
+    }
+
+public:
+    using prf_type = prf;
+    static constexpr size_t row_block = 32;   // apply's unit of work
+
+    random_projection() = default;
+    // The key range is treated like the argument of
+    // counter_based_engine::seed(InRange), with two counter words.
+    // s is the sparsity of projection_kind::sparse, at least 1.
+    template <detail::integral_input_range InRange>
+    random_projection(InRange key, size_t rows, size_t cols,
+                      projection_kind kind_ = projection_kind::rademacher,
+                      double scale_ = 1., double s = 3.) :
+        nrows(rows), ncols(cols), kind(kind_), scale(scale_)
+    {
+        auto kp = ranges::begin(key);
+        auto ke = ranges::end(key);
+        for(size_t i=2; i<input_count; ++i)
+            in[i] = (kp == ke) ? 0 : input_value_type(*kp++);
+        if(kind == projection_kind::sparse){
+            if(!(s >= 1. && s <= 0x1p15))
+                throw invalid_argument("random_projection:  the sparsity must be in [1, 2^15]");
+            sparse_threshold = uint32_t(std::max(1., std::round(0x1p15/s)));
+            sparse_value = scale*sqrt(0x1p15/sparse_threshold);
+        }
+    }
+    template <integral T>
+    random_projection(initializer_list<T> key, size_t rows, size_t cols,
+                      projection_kind kind_ = projection_kind::rademacher,
+                      double scale_ = 1., double s = 3.) :
+        random_projection(ranges::subrange(key), rows, cols, kind_, scale_, s)
+    {}
+
+    size_t rows() const { return nrows; }
+    size_t cols() const { return ncols; }
+
+    // R(i, j)
+    double operator()(size_t i, size_t j) const{
+        const size_t E = entries_per_block();
+        array<uint64_t, result_count> w;
+        in_type inn = in;
+        inn[0] = j/E;
+        inn[1] = i;
+        prf{}(ranges::begin(inn), ranges::begin(w));
+        return entry(w.data(), j%E);
+    }
+
+    // y[0, rows) = R x[0, cols)
+    void apply(const double* x, double* y, unsigned threads = 0) const{
+        detail::parallel_for((nrows + row_block - 1)/row_block, threads, [&](size_t b, unsigned){
+            const size_t i0 = b*row_block;
+            const size_t i1 = std::min(nrows, i0 + row_block);
+            // Eight partial sums per row, in a fixed order.
+            array<array<double, 8>, row_block> acc{};
+            for_each_tile(i0, i1, 0, ncols, [&](size_t i, size_t c0, size_t n, const double* e){
+                // A local copy, which gcc can keep in registers.
+                array<double, 8> a = acc[i - i0];
+                const double* xx = x + c0;
+                size_t k = 0;
+                for(; k+8<=n; k+=8)
+                    for(size_t l=0; l<8; ++l)
+                        a[l] += e[k+l]*xx[k+l];
+                for(; k<n; ++k)
+                    a[k%8] += e[k]*xx[k];
+                acc[i - i0] = a;
+            });
+            for(size_t i=i0; i<i1; ++i){
+                const auto& a = acc[i - i0];
+                y[i] = ((a[0] + a[1]) + (a[2] + a[3])) + ((a[4] + a[5]) + (a[6] + a[7]));
+            }
+        });
+    }
+
+    // x[0, cols) = R^T y[0, rows)
+    void apply_transpose(const double* y, double* x, unsigned threads = 0) const{
+        detail::parallel_for((ncols + tile_cols - 1)/tile_cols, threads, [&](size_t b, unsigned){
+            const size_t c_lo = b*tile_cols;
+            const size_t c_hi = std::min(ncols, c_lo + tile_cols);
+            alignas(64) array<double, tile_cols> acc{};
+            for_each_tile(0, nrows, c_lo, c_hi, [&](size_t i, size_t, size_t n, const double* e){
+                const double yi = y[i];
+                for(size_t k=0; k<n; ++k)
+                    acc[k] += e[k]*yi;
+            });
+            ranges::copy(acc.begin(), acc.begin() + (c_hi - c_lo), x + c_lo);
+        });
+    }
+};
+
+} // namespace std
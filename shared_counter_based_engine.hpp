@@ -0,0 +1,121 @@
+#pragma once
+
+// shared_counter_based_engine<prf, c> - one logical stream that many
+// threads can draw from at once, without locks.
+//
+// The state is a key and an atomic count of the values handed out so
+// far.  Every call reserves exactly as many values as it needs with a
+// single fetch_add, and then computes them locally, with the prf's bulk
+// generate for the whole blocks.  So every value of the stream is
+// delivered exactly once, but the order in which threads get them is
+// whatever the fetch_adds' order happens to be.
+//
+// The values are those of compact_counter_based_engine<prf, c> (and
+// counter_based_engine<prf, c>) with the same seed.  Bulk calls,
+// operator()(b, e), are the efficient way to use it.  Threads that
+// draw one value at a time should each get a local_engine:
+//
+//     auto local = shared.local();
+//     normal_distribution<double> nd;
+//     for(...) x = nd(local);
+//
+// which reserves buffer_count values at a time, computes them with
+// one bulk call, and hands them out from its buffer.  Values it has
+// reserved but not handed out when it's destroyed are skipped:  no one
+// else gets them.  operator()() on the shared engine itself is a slow
+// fallback:  it reserves one value and computes its whole block, i.e.,
+// it costs an atomic and a prf call per value.
+//
+// It satisfies uniform_random_bit_generator, so it can drive the
+// standard distributions, but it isn't a Random Number Engine:  it
+// can't be copied, compared or streamed.  The count wraps around after
+// 2^(c*w) values.
+
+#include "compact_counter_based_engine.hpp"
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <iterator>
+#include <ranges>
+#include <initializer_list>
+
+namespace std{
+
+template <typename prf, size_t c>
+class shared_counter_based_engine{
+    using local_type = compact_counter_based_engine<prf, c>;
+    static_assert(c*prf::input_word_size <= 64, "the shared counter must fit in a lock-free atomic");
+    static_assert(atomic<uint64_t>::is_always_lock_free);
+
+    local_type proto;            // the key, with the counter at zero
+    atomic<uint64_t> next{0};    // the index of the next unreserved value
+
+    // A local engine positioned at the first of n newly reserved values.
+    local_type reserve(uint64_t n){
+        local_type ret = proto;
+        ret.discard(next.fetch_add(n, memory_order_relaxed));
+        return ret;
+    }
+
+public:
+    using result_type = local_type::result_type;
+    using prf_type = prf;
+    static constexpr result_type min(){ return local_type::min(); }
+    static constexpr result_type max(){ return local_type::max(); }
+
+    shared_counter_based_engine() = default;
+    explicit shared_counter_based_engine(result_type s) : proto(s){}
+    template <detail::integral_input_range InRange>
+    explicit shared_counter_based_engine(InRange key) : proto(key){}
+    template <integral T>
+    explicit shared_counter_based_engine(initializer_list<T> key) : proto(key){}
+    shared_counter_based_engine(const shared_counter_based_engine&) = delete;
+    shared_counter_based_engine& operator=(const shared_counter_based_engine&) = delete;
+
+    // One value at a time, from one thread, buffered.  See above.
+    // It refers to the shared engine, which must outlive it.
+    static constexpr size_t buffer_count = 16*prf::output_count;
+    class local_engine{
+    public:
+        using result_type = shared_counter_based_engine::result_type;
+        static constexpr result_type min(){ return local_type::min(); }
+        static constexpr result_type max(){ return local_type::max(); }
+
+        result_type operator()(){
+            if(pos == buf.size()){
+                shared->reserve(buf.size())(buf.begin(), buf.end());
+                pos = 0;
+            }
+            return buf[pos++];
+        }
+
+    private:
+        friend class shared_counter_based_engine;
+        explicit local_engine(shared_counter_based_engine& s) : shared(&s){}
+        shared_counter_based_engine* shared;
+        array<result_type, buffer_count> buf;
+        size_t pos = buffer_count;
+    };
+    local_engine local(){ return local_engine(*this); }
+
+    // The slow fallback:  an atomic and a prf call per value.
+    result_type operator()(){
+        return reserve(1)();
+    }
+
+    template <output_iterator<const result_type&> O, sized_sentinel_for<O> S>
+    O operator()(O out, S sen){
+        auto n = sen - out;
+        if(n <= 0)
+            return out;
+        return reserve(n)(out, sen);
+    }
+
+    // How many values have been handed out so far.
+    uint64_t values_reserved() const { return next.load(memory_order_relaxed); }
+};
+
+using shared_philox4x64 = shared_counter_based_engine<philox4x64_prf, 1>;
+using shared_threefry4x64 = shared_counter_based_engine<threefry4x64_prf, 1>;
+
+} // namespace std
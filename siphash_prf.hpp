@@ -14,9 +14,11 @@
 // being adapted into a PRF.
 
 #include "detail.hpp"
+#include "prf_counters.hpp"
 #include <array>
 #include <ranges>
 #include <cstring>
+#include <algorithm>
 
 extern "C"{
 // see siphash.c
@@ -56,6 +58,7 @@ public:
              std::integral<std::iter_value_t<O>> &&
              std::indirectly_writable<O, std::iter_value_t<O>>
     O generate(InRange&& inrange, O result) const{
+        std::detail::instrument([&](auto& ctrs){ ctrs.prf_blocks += std::ranges::size(inrange); });
         for(auto in : inrange){
             uint64_t out[2];
             // Call siphash with the first 16 bytes (in[0] and in[1]) 
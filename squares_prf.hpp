@@ -0,0 +1,256 @@
+#pragma once
+
+// squares_prf<w> - Widynski's "Squares" counter-based generator
+// (B. Widynski, "Squares: A Fast Counter-Based RNG",
+// arXiv:2004.06278), as a prf.  It's a handful of 64-bit multiplies
+// per output:  four 'middle-square' rounds for the 32-bit output
+// (w=32), five for the 64-bit output (w=64).  That's much less
+// arithmetic per value than philox or threefry, but it has had far
+// less scrutiny and it isn't cryptographic in any sense.  It's meant
+// for bulk noise where philox-grade quality isn't needed.  (How much
+// faster it actually is depends on the hardware's vector multiplies.
+// See bench --compare.)
+//
+// The input is two 64-bit words:  a counter and a key.  Squares is
+// only good with 'well-formed' keys (Widynski generates his with
+// irregular, mostly distinct, hex digits), so we don't use the key
+// word directly.  It's first scrambled with the bijective murmur3/
+// splitmix finalizer and made odd, by key_schedule.  Hence, any key
+// word is usable, and squares_prf<w>'s output for (ctr, key) is
+// Widynski's squares32 or squares64 of (ctr, key_schedule(key)).  But
+// there are only 2^63 odd keys, so the keys pair up:  k and k', with
+// fmix(k') == fmix(k)^1, have the same schedule and give identical
+// streams.  The pairs are scattered by the finalizer (no two keys
+// below 2^28 collide), so small or sequential keys are safe, but two
+// random 64-bit keys collide with probability 2^-64, not zero.
+//
+// Each block is just one value, so the engine calls generate for
+// everything it delivers.  generate computes several gcc vectors
+// (PRF_SIMD_SIZE_BYTES wide) of blocks at a time, and recomputes the
+// key schedule only when the key changes, i.e., never, in the engine.
+
+#include "detail.hpp"
+#include "prf_counters.hpp"
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <iterator>
+#include <ranges>
+#include <span>
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpsabi"
+
+namespace std{
+
+template <size_t w>
+class squares_prf{
+    static_assert(w == 32 || w == 64, "squares_prf has 32- and 64-bit outputs");
+public:
+    using output_value_type = detail::uint_least<w>;
+    using input_value_type = uint_least64_t;
+    static constexpr size_t input_word_size = 64;
+    static constexpr size_t output_word_size = w;
+    static constexpr size_t input_count = 2;   // counter, key
+    static constexpr size_t output_count = 1;
+
+    static constexpr uint64_t key_schedule(uint64_t k){
+        k ^= k >> 33;
+        k *= 0xff51afd7ed558ccdull;
+        k ^= k >> 33;
+        k *= 0xc4ceb9fe1a85ec53ull;
+        k ^= k >> 33;
+        return k | 1;
+    }
+
+    template<typename InputIterator1, typename OutputIterator2>
+    OutputIterator2 operator()(InputIterator1 input, OutputIterator2 output){
+        return generate(ranges::single_view(input), output);
+    }
+
+    template <ranges::input_range InRange, weakly_incrementable O>
+    requires ranges::sized_range<InRange> &&
+             integral<iter_value_t<ranges::range_value_t<InRange>>> &&
+             integral<iter_value_t<O>> &&
+             indirectly_writable<O, iter_value_t<O>>
+    O generate(InRange&& in, O result) const{
+        detail::instrument([&](auto& ctrs){ ctrs.prf_blocks += ranges::size(in); });
+        auto cp = ranges::begin(in);
+        auto nleft = ranges::size(in);
+        // The last key seen, and its schedule.
+        uint64_t rawkey = 0;
+        uint64_t key = key_schedule(0);
+#if PRF_SIMD_SIZE_BYTES
+        // Each value is a chain of dependent multiplies, so work on
+        // several independent vectors at once to hide their latency.
+        constexpr size_t nv = interleave;
+        while(nleft >= nv*simd_N){
+            nleft -= nv*simd_N;
+            auto r = next_vectors(cp, rawkey, key);
+            // Write whole vectors into contiguous output.
+            if constexpr (contiguous_iterator<O> &&
+                          unsigned_integral<iter_value_t<O>> &&
+                          sizeof(iter_value_t<O>) == sizeof(output_value_type)){
+                store_vectors(r, to_address(result));
+                result += nv*simd_N;
+            }else{
+                for(const auto& rv : r)
+                    for(size_t s=0; s<simd_N; ++s)
+                        *result++ = output_value_type(rv[s]);
+            }
+        }
+#endif // PRF_SIMD_SIZE_BYTES
+        while(nleft--)
+            *result++ = next_scalar(cp, rawkey, key);
+        return result;
+    }
+
+    // A fused alternative to generate (see threefry_prf::for_each_block):
+    // call f(span<const output_value_type>) with each group of
+    // interleaved vectors' worth of results, in order, as soon as
+    // they're computed, rather than writing them to an output iterator.
+    // It returns f.
+    template <ranges::input_range InRange, typename F>
+    requires ranges::sized_range<InRange> &&
+             integral<iter_value_t<ranges::range_value_t<InRange>>> &&
+             invocable<F&, span<const output_value_type>>
+    F for_each_block(InRange&& in, F f) const{
+        detail::instrument([&](auto& ctrs){ ctrs.prf_blocks += ranges::size(in); });
+        auto cp = ranges::begin(in);
+        auto nleft = ranges::size(in);
+        uint64_t rawkey = 0;
+        uint64_t key = key_schedule(0);
+#if PRF_SIMD_SIZE_BYTES
+        constexpr size_t nv = interleave;
+        while(nleft >= nv*simd_N){
+            nleft -= nv*simd_N;
+            auto r = next_vectors(cp, rawkey, key);
+            alignas(simd_size) output_value_type block[nv*simd_N];
+            store_vectors(r, block);
+            f(span<const output_value_type>(block));
+        }
+#endif // PRF_SIMD_SIZE_BYTES
+        while(nleft--){
+            output_value_type v = next_scalar(cp, rawkey, key);
+            f(span<const output_value_type>(&v, 1));
+        }
+        return f;
+    }
+
+private:
+#if PRF_SIMD_SIZE_BYTES
+    static constexpr size_t simd_size = PRF_SIMD_SIZE_BYTES;
+    static constexpr size_t simd_N = simd_size/sizeof(uint64_t);
+    using simd_type = detail::simd_vec<uint64_t, simd_size>::type;
+    static constexpr size_t interleave = 4;
+
+    // Fill the lanes of c and k from the next interleave*simd_N
+    // inputs, and return whether every key equals rawkey.  gcc doesn't
+    // understand that filling every lane of a simd vector, one at a
+    // time, initializes it, so the warnings are off for these stores
+    // only.
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+#pragma GCC diagnostic ignored "-Wuninitialized"
+    template <typename I>
+    [[gnu::always_inline]] static inline bool load_vectors(I& cp, array<simd_type, interleave>& c, array<simd_type, interleave>& k, uint64_t rawkey){
+        bool same = true;
+        for(size_t v=0; v<interleave; ++v){
+            for(size_t s=0; s<simd_N; ++s){
+                auto initer = *cp++;
+                c[v][s] = *initer++;
+                k[v][s] = *initer;
+                same &= (k[v][s] == rawkey);
+            }
+        }
+        return same;
+    }
+#pragma GCC diagnostic pop
+
+    // Compute the next interleave*simd_N results, from the inputs at
+    // cp.  rawkey and key are the last key seen, and its schedule.
+    template <typename I>
+    [[gnu::always_inline]] static inline array<simd_type, interleave> next_vectors(I& cp, uint64_t& rawkey, uint64_t& key){
+        constexpr size_t nv = interleave;
+        array<simd_type, nv> c, k;
+        const bool same = load_vectors(cp, c, k, rawkey);
+        if(same){
+            for(auto& kv : k)
+                kv = simd_type{} + key;
+        }else{
+            rawkey = k[nv-1][simd_N-1];
+            for(auto& kv : k)
+                kv = key_schedule_v(kv);
+            key = k[nv-1][simd_N-1];
+        }
+        array<simd_type, nv> r;
+        for(size_t v=0; v<nv; ++v)
+            r[v] = squares(c[v], k[v]);
+        return r;
+    }
+
+    // Write the results in r, in order, as output_value_types, to p.
+    [[gnu::always_inline]] static inline void store_vectors(const array<simd_type, interleave>& r, void* p){
+        for(size_t v=0; v<interleave; ++v){
+            if constexpr (w == 64){
+                memcpy(static_cast<char*>(p) + v*sizeof(simd_type), &r[v], sizeof(simd_type));
+            }else{
+                auto r32 = __builtin_convertvector(r[v], typename detail::simd_vec<uint32_t, simd_size/2>::type);
+                memcpy(static_cast<char*>(p) + v*sizeof(r32), &r32, sizeof(r32));
+            }
+        }
+    }
+
+    static simd_type key_schedule_v(simd_type k){
+        k ^= k >> 33;
+        k *= 0xff51afd7ed558ccdull;
+        k ^= k >> 33;
+        k *= 0xc4ceb9fe1a85ec53ull;
+        k ^= k >> 33;
+        return k | 1;
+    }
+#endif // PRF_SIMD_SIZE_BYTES
+
+    template <typename I>
+    [[gnu::always_inline]] static inline output_value_type next_scalar(I& cp, uint64_t& rawkey, uint64_t& key){
+        auto initer = *cp++;
+        uint64_t c = *initer++;
+        uint64_t k = *initer;
+        if(k != rawkey){
+            rawkey = k;
+            key = key_schedule(k);
+        }
+        return output_value_type(squares(c, key));
+    }
+
+    // The rounds are templated on U, so that they work with uint64_t
+    // or with a simd vector of uint64_t.  The result is in the low w
+    // bits.
+    template <typename U>
+    [[gnu::always_inline]] static inline U rot32(U x){
+        return (x >> 32) | (x << 32);
+    }
+
+    template <typename U>
+    [[gnu::always_inline]] static inline U squares(U ctr, U key){
+        U y = ctr * key;
+        U z = y + key;
+        U x = rot32(y*y + y);
+        x = rot32(x*x + z);
+        x = rot32(x*x + y);
+        if constexpr (w == 32){
+            return (x*x + z) >> 32;
+        }else{
+            U t = x*x + z;
+            x = rot32(t);
+            return t ^ ((x*x + y) >> 32);
+        }
+    }
+};
+
+using squares32_prf = squares_prf<32>;
+using squares64_prf = squares_prf<64>;
+
+} // namespace std
+
+#pragma GCC diagnostic pop
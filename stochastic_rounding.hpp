@@ -0,0 +1,234 @@
+#pragma once
+
+// stochastic_rounder<prf, c> - bulk stochastic rounding of float and
+// double arrays to bfloat16, IEEE half (fp16) and float, e.g., for
+// low-precision training and mixed-precision solvers:
+//
+//     stochastic_rounder<> sr({seed, step});
+//     sr.to_bf16(x, xb, n);             // xb[i] is the bf16 bit pattern
+//     sr.to_fp16(x, xh, n, first);      // x[i] is element first+i
+//     sr.to_fp32(xd, xf, n);
+//
+// A value is rounded to one of the two representable neighbours that
+// bracket it, up (away from zero) with probability equal to the
+// fraction of the gap it covers, so the rounding is unbiased.  The
+// 16-bit results are delivered as bit patterns (uint16_t), since C++20
+// has no types for them.
+//
+// Element i (counting from 0 at the start of the whole array) is
+// rounded with F random bits, where F is 16 for float input and 32 for
+// double:  field i%(W/F) of value i/(W/F) of the stream that
+// counter_based_engine<prf, c>(key) would produce, with W the prf's
+// output_word_size.  So the result depends only on the key and the
+// element's index.  A big array can be split among threads any way
+// at all, with each thread passing the index of its first element as
+// 'first', and the results are identical to one call.
+//
+// The random bits come straight from prf::generate, into a small
+// buffer that's reinterpreted as an array of F-bit fields, and the
+// rounding itself is branch-free integer and floating-point code that
+// gcc vectorizes.
+//
+// When the rounded result is a normal number, the probability is
+// exact if the dropped bits are no more than F (all the conversions
+// from float, and double to float).  Otherwise (e.g., double to bf16,
+// or a subnormal result), it's rounded down to a multiple of 2^-F.  Values
+// that round up past the largest finite value become infinities.
+// Infinities are preserved, and NaNs become quiet NaNs with the same
+// sign.
+
+#include "detail.hpp"
+#include "threefry_prf.hpp"
+#include <array>
+#include <bit>
+#include <cstdint>
+#include <cstring>
+#include <initializer_list>
+#include <limits>
+#include <ranges>
+#include <type_traits>
+
+namespace std{
+
+namespace detail{
+
+// The formats we round to:  the number of explicit mantissa bits and
+// the exponent bias.
+struct bf16_format{ using bits_type = uint16_t; static constexpr int mant = 7; static constexpr int bias = 127; };
+struct fp16_format{ using bits_type = uint16_t; static constexpr int mant = 10; static constexpr int bias = 15; };
+struct fp32_format{ using bits_type = uint32_t; static constexpr int mant = 23; static constexpr int bias = 127; };
+
+template <typename T>
+constexpr T pow2(int e){
+    T ret = 1;
+    for(; e > 0; --e)
+        ret *= 2;
+    for(; e < 0; ++e)
+        ret /= 2;
+    return ret;
+}
+
+// c ? x : y, with bit operations.  gcc turns ?: into a branch if
+// one side has floating-point arithmetic that might trap (with the
+// default -ftrapping-math), and then it won't vectorize the loop.
+template <typename T>
+[[gnu::always_inline]] inline T blend(bool c, T x, T y){
+    const T m = -T(c);
+    return (x & m) | (y & ~m);
+}
+
+// Round x to the format To, up with probability given by the
+// F-bit random field r, and return the result's bit pattern.
+template <typename To, typename Src, typename R>
+[[gnu::always_inline]] inline typename To::bits_type stochastic_round(Src x, R r){
+    using S = conditional_t<sizeof(Src) == 4, uint32_t, uint64_t>;
+    using T = To::bits_type;
+    constexpr int W = numeric_limits<S>::digits;
+    constexpr int F = numeric_limits<R>::digits;
+    constexpr int q = numeric_limits<Src>::digits - 1;   // source mantissa bits
+    constexpr int bias = numeric_limits<Src>::max_exponent - 1;
+    constexpr int p = To::mant;
+    constexpr int d = q - p;                             // bits dropped from a normal result
+    constexpr int emin = 1 - To::bias;                   // the smallest normal exponent
+    constexpr S inf = S(2*bias + 1) << q;
+    constexpr T inf_t = T(2*To::bias + 1) << p;
+    static_assert(d > 0 && To::bias <= bias);
+
+    const S b = bit_cast<S>(x);
+    const S a = b & ~(S(1) << (W-1));
+    // If the result is normal:  add d random bits below its last
+    // mantissa bit and truncate.  A carry into the exponent is right.
+    const S rd = F >= d ? S(r) >> (F - d) : S(r) << (d - F);
+    const S an = (a + rd) >> d;
+    T ret = blend(an >= (S(bias + To::bias + 1) << p), inf_t, T(an - (S(bias - To::bias) << p)));
+    // Below the smallest normal, the results are multiples of
+    // 2^(emin-p), whose bit patterns are just the multipliers.  If the
+    // source format has more range, count them with floating-point
+    // arithmetic, which is exact here, and compare the top F bits of
+    // the fraction with r.  (gcc won't vectorize floor or a
+    // floating-point comparison, with the default -ftrapping-math.)  If it
+    // doesn't have more range, the bits above are already right.
+    // Lanes that aren't below the smallest normal are zeroed first, so
+    // that every conversion to I is in range.
+    if constexpr (emin > numeric_limits<Src>::min_exponent - 1){
+        using I = conditional_t<sizeof(Src) == 4, int32_t, int64_t>;
+        const bool sub = a < (S(bias + emin) << q);
+        const Src y = bit_cast<Src>(blend(sub, a, S(0))) * pow2<Src>(p - emin);
+        const I k = I(y);   // floor, but vectorizable
+        const I frac = I((y - Src(k)) * pow2<Src>(F));
+        const T ts = T(k + (I(r) < frac));
+        ret = blend(sub, ts, ret);
+    }
+    ret = blend(a > inf, T(inf_t | T(1) << (p-1)), ret);
+    return ret | T(b >> (W-1)) << (numeric_limits<T>::digits - 1);
+}
+
+} // namespace detail
+
+template <typename prf = threefry4x64_prf, size_t c = 1>
+class stochastic_rounder{
+    static_assert(c > 0 && c <= prf::input_count);
+    static_assert(prf::output_word_size == 32 || prf::output_word_size == 64);
+    static constexpr size_t result_count = prf::output_count;
+    static constexpr size_t input_count = prf::input_count;
+    static constexpr size_t input_word_size = prf::input_word_size;
+    static constexpr size_t word_size = prf::output_word_size;
+    using input_value_type = prf::input_value_type;
+    using result_type = prf::output_value_type;
+    using in_type = array<input_value_type, input_count>;
+    static constexpr auto in_mask = detail::fffmask<input_value_type, prf::input_word_size>;
+
+    in_type in{};   // the key, with the counter words zero
+
+    // Elements are done this many at a time.
+    static constexpr size_t chunk = 2048;
+
+    template <typename To, typename Src, typename Dst>
+    void round(const Src* x, Dst* out, size_t n, uint64_t first) const{
+        using R = conditional_t<sizeof(Src) == 4, uint16_t, uint32_t>;
+        constexpr size_t fields = word_size/numeric_limits<R>::digits;   // per prf value
+        constexpr size_t block_fields = fields*result_count;
+        // The prf results for up to 'chunk' elements, wherever they
+        // start in a block, and the same bits as F-bit fields.
+        constexpr size_t max_blocks = chunk/block_fields + 2;
+        array<result_type, max_blocks*result_count> buf;
+        array<R, max_blocks*block_fields> rbits;
+        while(n){
+            const size_t m = std::min<size_t>(n, chunk);
+            const uint64_t b0 = first/block_fields;
+            const uint64_t b1 = (first + m - 1)/block_fields + 1;
+            in_type inn;
+            prf{}.generate(ranges::views::iota(b0, b1) |
+                           ranges::views::transform([&](uint64_t blk){
+                                                        inn = in;
+                                                        set_counter(inn, blk);
+                                                        return ranges::begin(inn);
+                                                    }),
+                           buf.begin());
+            const size_t nw = (b1 - b0)*result_count;
+            if constexpr (endian::native == endian::little && sizeof(result_type)*8 == word_size){
+                memcpy(rbits.data(), buf.data(), nw*sizeof(result_type));
+            }else{
+                for(size_t w=0; w<nw; ++w)
+                    for(size_t f=0; f<fields; ++f)
+                        rbits[w*fields + f] = R(buf[w] >> (f*numeric_limits<R>::digits));
+            }
+            const R* r = rbits.data() + (first - b0*block_fields);
+            for(size_t i=0; i<m; ++i){
+                auto t = detail::stochastic_round<To>(x[i], r[i]);
+                if constexpr (is_floating_point_v<Dst>)
+                    out[i] = bit_cast<Dst>(t);
+                else
+                    out[i] = t;
+            }
+            x += m;
+            out += m;
+            first += m;
+            n -= m;
+        }
+    }
+
+    static void set_counter(in_type& inn, uint64_t blk){
+        for(size_t i=0; i<c; ++i){
+            inn[i] = input_value_type(blk) & in_mask;
+            blk = input_word_size < 64 ? blk >> input_word_size : 0;
+        }
+    }
+
+public:
+    using prf_type = prf;
+    static constexpr size_t counter_count = c;
+
+    stochastic_rounder() = default;
+    // The key range is treated like the argument of
+    // counter_based_engine::seed(InRange).
+    template <detail::integral_input_range InRange>
+    explicit stochastic_rounder(InRange key){
+        auto kp = ranges::begin(key);
+        auto ke = ranges::end(key);
+        for(size_t i=c; i<input_count; ++i)
+            in[i] = (kp == ke) ? 0 : input_value_type(*kp++) & in_mask;
+    }
+    template <integral T>
+    stochastic_rounder(initializer_list<T> key) : stochastic_rounder(ranges::subrange(key)){}
+
+    // Round x[0, n), which are elements [first, first+n) of the whole
+    // array, to out[0, n).
+    void to_bf16(const float* x, uint16_t* out, size_t n, uint64_t first = 0) const{
+        round<detail::bf16_format>(x, out, n, first);
+    }
+    void to_bf16(const double* x, uint16_t* out, size_t n, uint64_t first = 0) const{
+        round<detail::bf16_format>(x, out, n, first);
+    }
+    void to_fp16(const float* x, uint16_t* out, size_t n, uint64_t first = 0) const{
+        round<detail::fp16_format>(x, out, n, first);
+    }
+    void to_fp16(const double* x, uint16_t* out, size_t n, uint64_t first = 0) const{
+        round<detail::fp16_format>(x, out, n, first);
+    }
+    void to_fp32(const double* x, float* out, size_t n, uint64_t first = 0) const{
+        round<detail::fp32_format>(x, out, n, first);
+    }
+};
+
+} // namespace std
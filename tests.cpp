@@ -1,10 +1,35 @@
 #include <iostream>
+// This is built twice:  as tests, in the default configuration that
+// bench, randfile and libcbe.so are built with, and as tests_tuned,
+// with -DPRF_INSTRUMENT=1 -DPRF_AUTOTUNE=1, which also checks the
+// instrumentation and the autotuning.  (See GNUmakefile.)
 #include "counter_based_engine.hpp"
 #include "philox_prf.hpp"
 #include "threefry_prf.hpp"
+#include "squares_prf.hpp"
+#include "counter_based_view.hpp"
+#include "counter_based_permutation.hpp"
+#include "counter_based_grid.hpp"
+#include "alias_discrete_distribution.hpp"
+#include "bernoulli_mask.hpp"
+#include "compact_counter_based_engine.hpp"
+#include "shared_counter_based_engine.hpp"
+#include "counter_range_allocator.hpp"
+#include "random_file.hpp"
+#include "stochastic_rounding.hpp"
+#include "random_projection.hpp"
+#include "cbe.h"
 #include <iostream>
 #include <sstream>
+#include <fstream>
 #include <cassert>
+#include <bit>
+#include <cmath>
+#include <deque>
+#include <thread>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
 
 // Save some typing:
 using namespace std;
@@ -49,7 +74,1015 @@ void dokat(const std::string& s){
     cout << "PASSED: " << s << endl;
 }
 
+// A direct, unoptimized transcription of Threefish (with a zero
+// tweak) from the specification.  The rotation constants are
+// rot[round%8][pair], i.e., transposed with respect to the template
+// arguments of threefry_prf.  It's used to check the compile-time round
+// schedule for the 8- and 16-word threefry_prfs, for which there are
+// no Random123 known-answer tests.
+template <size_t N>
+array<uint64_t, N> threefish(array<uint64_t, N> v, const array<uint64_t, N>& key, size_t R,
+                             const int (&rot)[8][N/2], const size_t (&pi)[N]){
+    array<uint64_t, N+1> k;
+    k[N] = 0x1BD11BDAA9FC1A22;
+    for(size_t i=0; i<N; ++i){
+        k[i] = key[i];
+        k[N] ^= key[i];
+    }
+    auto addkey = [&](size_t s){
+        for(size_t i=0; i<N; ++i)
+            v[i] += k[(s+i)%(N+1)] + (i==N-1 ? s : 0);
+    };
+    for(size_t d=0; d<R; ++d){
+        if(d%4 == 0)
+            addkey(d/4);
+        array<uint64_t, N> f;
+        for(size_t j=0; j<N/2; ++j){
+            f[2*j] = v[2*j] + v[2*j+1];
+            f[2*j+1] = rotl(v[2*j+1], rot[d%8][j]) ^ f[2*j];
+        }
+        for(size_t i=0; i<N; ++i)
+            v[i] = f[pi[i]];
+    }
+    if(R%4 == 0)
+        addkey(R/4);
+    return v;
+}
+
+template <typename PRF, size_t R>
+void check_threefish(const auto& rot, const auto& pi){
+    static constexpr size_t N = PRF::output_count;
+    array<uint64_t, 2*N> in;
+    uint64_t x = 0x243f6a8885a308d3;
+    for(size_t trial=0; trial<10; ++trial){
+        for(auto& v : in){
+            v = x;
+            x = x*6364136223846793005 + 1442695040888963407;
+        }
+        array<uint64_t, N> ctr, key, result;
+        copy_n(begin(in), N, begin(ctr));
+        copy_n(begin(in)+N, N, begin(key));
+        PRF{}(begin(in), begin(result));
+        assert(result == threefish<N>(ctr, key, R, rot, pi));
+    }
+    cout << dec << "PASSED: threefry" << N << "x64_prf_r<" << R << "> matches Threefish" << endl;
+}
+
+// Bulk generation and one-at-a-time generation should produce the
+// same values.
+template <typename EngT>
+void check_bulk(){
+    EngT bulkeng({1, 2, 3});
+    EngT scalareng({1, 2, 3});
+    // Long enough to use the simd code in threefry_prf.
+    vector<typename EngT::result_type> bulk(1000), scalar(1000);
+    bulkeng(begin(bulk), end(bulk));
+    for(auto& v : scalar)
+        v = scalareng();
+    assert(bulkeng == scalareng);
+    // A non-contiguous output range goes through a staging buffer.
+    EngT dequeeng({1, 2, 3});
+    deque<typename EngT::result_type> dq(bulk.size());
+    dequeeng(begin(dq), end(dq));
+    assert(dequeeng == bulkeng);
+    assert(ranges::equal(dq, bulk));
+    assert(bulk == scalar);
+}
+
+// fill_unordered should deliver the same values as operator()(b, e),
+// and leave the engine in the same state, but with the whole prf
+// blocks permuted as documented in threefry_prf::generate.
+template <typename EngT>
+void check_unordered(){
+    using prf_t = EngT::prf_type;
+    static constexpr size_t N = prf_t::output_count;
+    // prfs without an unordered_results overload don't permute.
+    static constexpr size_t G = [](){
+        if constexpr (requires { prf_t::unordered_group_count; })
+            return prf_t::unordered_group_count;
+        else
+            return size_t(1);
+    }();
+    EngT ordered({4, 5, 6});
+    EngT unordered({4, 5, 6});
+    // Start with some leftover results.
+    ordered();
+    unordered();
+    const size_t len = 1001;
+    vector<typename EngT::result_type> o(len), u(len);
+    ordered(begin(o), end(o));
+    unordered.fill_unordered(begin(u), end(u));
+    assert(ordered == unordered);
+
+    const size_t lead = N-1;
+    const size_t nblocks = (len - lead)/N;
+    auto expected = o;
+    for(size_t g=0; g+G <= nblocks; g += G)
+        for(size_t s=0; s<G; ++s)
+            for(size_t i=0; i<N; ++i)
+                expected[lead + g*N + i*G + s] = o[lead + (g+s)*N + i];
+    assert(u == expected);
+
+    // The permutation doesn't depend on the kind of output iterator.
+    EngT dequeeng({4, 5, 6});
+    dequeeng();
+    deque<typename EngT::result_type> dq(len);
+    dequeeng.fill_unordered(begin(dq), end(dq));
+    assert(dequeeng == ordered);
+    assert(ranges::equal(dq, u));
+}
+
+// for_each_block should hand the callback exactly the values that
+// operator()(b, e) would deliver, in order, and leave the engine in
+// the same state, whatever the sizes of the calls.
+template <typename EngT>
+void check_for_each_block(){
+    EngT bulkeng({7, 1}), fusedeng({7, 1});
+    vector<typename EngT::result_type> bulk, fused;
+    for(size_t len : {0, 1, 3, 1000, 5, 0, 64, 7, 333, 2}){
+        size_t old = bulk.size();
+        bulk.resize(old + len);
+        bulkeng(bulk.begin() + old, bulk.end());
+        fusedeng.for_each_block(len, [&](span<const typename EngT::result_type> s){
+                                         assert(!s.empty());
+                                         fused.insert(fused.end(), s.begin(), s.end());
+                                     });
+        assert(fusedeng == bulkeng);
+    }
+    assert(fused == bulk);
+    // A reduction, with a stateful functor passed by value, and
+    // returned.
+    struct summer{
+        uint64_t sum = 0;
+        void operator()(span<const typename EngT::result_type> s){
+            for(auto v : s)
+                sum += v;
+        }
+    };
+    uint64_t sum = 0;
+    summer sm;
+    sm = fusedeng.for_each_block(500, sm);
+    bulk.resize(500);
+    bulkeng(bulk.begin(), bulk.end());
+    for(auto v : bulk)
+        sum += v;
+    assert(sm.sum == sum);
+
+    // The prf's own for_each_block returns the functor, too.
+    using prf = EngT::prf_type;
+    using in_value_type = prf::input_value_type;
+    using out_value_type = prf::output_value_type;
+    struct prf_summer{
+        uint64_t sum = 0;
+        void operator()(span<const out_value_type> s){
+            for(auto v : s)
+                sum += v;
+        }
+    };
+    if constexpr (requires { prf{}.for_each_block(views::empty<in_value_type*>, prf_summer{}); }){
+        vector<array<in_value_type, prf::input_count>> ins(37);
+        for(size_t i=0; i<ins.size(); ++i)
+            ins[i].fill(i + 1);
+        auto inrange = ins | views::transform([](auto& a){ return a.begin(); });
+        vector<out_value_type> outs(ins.size()*prf::output_count);
+        prf{}.generate(inrange, outs.begin());
+        uint64_t prfsum = 0;
+        for(auto v : outs)
+            prfsum += v;
+        assert(prf{}.for_each_block(inrange, prf_summer{}).sum == prfsum);
+    }
+}
+
+// A counter_based_view should see the same values as the engine,
+// wherever it starts, in whatever order it's traversed.
+template <typename EngT>
+void check_view(){
+    using view_t = counter_based_view<typename EngT::prf_type, EngT::counter_count>;
+    static_assert(ranges::random_access_range<view_t>);
+    static_assert(ranges::sized_range<view_t>);
+    static_assert(ranges::view<view_t>);
+    EngT eng({7, 8, 9});
+    vector<typename EngT::result_type> ev(1000);
+    eng(begin(ev), end(ev));
+
+    view_t v({7, 8, 9}, ev.size());
+    assert(v.size() == ev.size());
+    assert(ranges::equal(v, ev));
+    for(size_t i=0; i<ev.size(); i += 37)
+        assert(v[i] == ev[i]);
+    assert(ranges::equal(v | views::reverse, ev | views::reverse));
+
+    // Iterators don't refer to the view, so they outlive it.
+    static_assert(ranges::borrowed_range<view_t>);
+    auto it = view_t({7, 8, 9}, ev.size()).begin() + 5;
+    auto it2 = ranges::begin(view_t({7, 8, 9}, ev.size(), 100));
+    assert(*it == ev[5] && it[10] == ev[15] && *it2 == ev[100]);
+
+    // Start part-way through a block.
+    view_t v13({7, 8, 9}, ev.size()-13, 13);
+    assert(ranges::equal(v13, ev | views::drop(13)));
+    assert(v13.end() - v13.begin() == ptrdiff_t(ev.size()-13));
+
+    // Split it across threads, the way a parallel algorithm would.
+    vector<typename EngT::result_type> pv(ev.size());
+    vector<thread> threads;
+    const ptrdiff_t nthreads = 4, chunk = (ev.size() + nthreads - 1)/nthreads;
+    for(ptrdiff_t t=0; t<nthreads; ++t)
+        threads.emplace_back([&, t](){
+            auto b = v.begin() + t*chunk;
+            auto e = v.begin() + std::min<ptrdiff_t>((t+1)*chunk, v.size());
+            ranges::copy(b, e, pv.begin() + t*chunk);
+        });
+    for(auto& th : threads)
+        th.join();
+    assert(pv == ev);
+}
+
+// A grid's bulk fills, of the whole box, of pieces of it, and of
+// strided slices, should agree with its one-at-a-time values, and no
+// two sites or components should collide.
+template <typename Grid>
+void check_grid(size_t ncomp){
+    using coords = Grid::coords_type;
+    Grid g({21}, {3, 3, 4}, ncomp);
+    const coords lo = {0, 0, 0}, hi = {6, 5, 9};
+    vector<typename Grid::result_type> whole(g.count(lo, hi));
+    assert(whole.size() == 6*5*9*ncomp);
+    assert(g.fill(lo, hi, whole.begin()) == whole.end());
+    auto at = [&](const coords& x, size_t comp){
+        return whole[((x[0]*5 + x[1])*9 + x[2])*ncomp + comp];
+    };
+    for(typename Grid::coord_type x=0; x<6; ++x)
+        for(typename Grid::coord_type y=0; y<5; ++y)
+            for(typename Grid::coord_type z=0; z<9; ++z)
+                for(size_t comp=0; comp<ncomp; ++comp)
+                    assert(at({x, y, z}, comp) == g({x, y, z}, comp));
+    auto sorted = whole;
+    ranges::sort(sorted);
+    assert(ranges::adjacent_find(sorted) == sorted.end());
+
+    // Decompose the box into 2x2x3 pieces, each filled separately, into
+    // a non-contiguous destination.
+    for(typename Grid::coord_type x0 : {0, 3})
+        for(typename Grid::coord_type y0 : {0, 2})
+            for(typename Grid::coord_type z0 : {0, 4, 7}){
+                coords plo = {x0, y0, z0};
+                coords phi = {x0 + 3, y0 == 0 ? 2 : 5, z0 == 0 ? 4 : z0 == 4 ? 7 : 9};
+                deque<typename Grid::result_type> piece(g.count(plo, phi));
+                g.fill(plo, phi, piece.begin());
+                auto p = piece.begin();
+                for(auto x=plo[0]; x<phi[0]; ++x)
+                    for(auto y=plo[1]; y<phi[1]; ++y)
+                        for(auto z=plo[2]; z<phi[2]; ++z)
+                            for(size_t comp=0; comp<ncomp; ++comp)
+                                assert(*p++ == at({x, y, z}, comp));
+                assert(p == piece.end());
+            }
+
+    // A strided slice.
+    const coords slo = {1, 0, 2}, stride = {2, 3, 3};
+    vector<typename Grid::result_type> slice(g.count(slo, hi, stride));
+    assert(slice.size() == 3*2*3*ncomp);
+    g.fill(slo, hi, stride, slice.begin());
+    auto p = slice.begin();
+    for(auto x=slo[0]; x<hi[0]; x += stride[0])
+        for(auto y=slo[1]; y<hi[1]; y += stride[1])
+            for(auto z=slo[2]; z<hi[2]; z += stride[2])
+                for(size_t comp=0; comp<ncomp; ++comp)
+                    assert(*p++ == at({x, y, z}, comp));
+
+    // Coordinates wrap modulo 2^bits, and the key matters.
+    assert(g({-1, 0, 0}) == g({7, 0, 0}));
+    assert(Grid({22}, {3, 3, 4}, ncomp)({1, 2, 3}) != g({1, 2, 3}));
+}
+
+#if PRF_INSTRUMENT
+// The instrumentation counters should account for every value and
+// every prf call.
+void check_counters(){
+    threefry4x64 eng({1, 2});   // 4 results per block
+    auto before = prf_counters_this_thread();
+    eng();
+    array<uint64_t, 10> v;
+    eng(begin(v), end(v));
+    eng.discard(2);
+    auto d = prf_counters_this_thread() - before;
+    assert(d.scalar_values == 1);
+    assert(d.bulk_calls == 1 && d.bulk_values == 10);
+    assert(d.bulk_size_log2[bit_width(10u)] == 1);
+    assert(d.saved_values == 3);      // left over from eng()
+    assert(d.generate_values == 4);   // one whole block
+    assert(d.refills == 2 && d.straggler_values == 1+3);
+    assert(d.discard_calls == 1 && d.discarded_values == 2);
+    // discard skipped the last value of one block and the first of the next
+    assert(d.wasted_values == 2);
+    assert(d.prf_blocks == 4);
+    assert(d.bytes == 11*8);
+
+    // for_each_block's whole blocks come from the prf's for_each_block
+    // if it has one, and via the staging buffer if not.
+    before = prf_counters_this_thread();
+    eng.for_each_block(9, [](auto){});
+    philox4x64({1, 2}).for_each_block(8, [](auto){});
+    d = prf_counters_this_thread() - before;
+    assert(d.bulk_calls == 2 && d.bulk_values == 17);
+    assert(d.saved_values == 3 && d.fused_values == 4 && d.staged_values == 8);
+    assert(d.refills == 1 && d.straggler_values == 2);
+    assert(d.prf_blocks == 4);
+
+    // Counters from exited threads are kept.
+    auto all_before = prf_counters_all_threads();
+    thread([](){ threefry4x64 e; e(); }).join();
+    auto all = prf_counters_all_threads() - all_before;
+    assert(all.scalar_values == 1 && all.prf_blocks == 1);
+    ostringstream oss;
+    oss << all;
+    assert(oss.str().find("scalar_values 1\n") != string::npos);
+}
+#endif // PRF_INSTRUMENT
+
+// counter_based_permutation should be a bijection, inverse should undo
+// it, and the bulk permute should agree with the one-at-a-time permute.
+template <typename Perm>
+void check_permutation(){
+    for(uint64_t N : {1, 2, 3, 7, 64, 1000, 1024, 4097}){
+        Perm perm(N, {11, 12});
+        vector<uint64_t> p(N);
+        perm.permute(0, N, p.begin());
+        vector<bool> seen(N);
+        for(uint64_t i=0; i<N; ++i){
+            assert(p[i] < N && !seen[p[i]]);
+            seen[p[i]] = true;
+            assert(perm.permute(i) == p[i]);
+            assert(perm.inverse(p[i]) == i);
+        }
+        if(N > 64){
+            // Not the identity, and the key matters.
+            assert(!ranges::equal(p, views::iota(uint64_t(0), N)));
+            Perm other(N, {11, 13});
+            assert(other.permute(0) != p[0] || other.permute(1) != p[1]);
+        }
+    }
+    // Huge N.  Spot-check the inverse and a bulk range in the middle.
+    const uint64_t big = 3'000'000'000'017;
+    Perm bigperm(big, {1});
+    vector<uint64_t> mid(100);
+    bigperm.permute(big/2, big/2 + mid.size(), mid.begin());
+    for(uint64_t i=0; i<mid.size(); ++i){
+        assert(mid[i] < big);
+        assert(mid[i] == bigperm.permute(big/2 + i));
+        assert(bigperm.inverse(mid[i]) == big/2 + i);
+    }
+}
+
+// The alias table should reproduce the weights, never return a
+// zero-weight index, and generate should deliver exactly what repeated
+// one-at-a-time draws would.
+void check_alias_distribution(){
+    alias_discrete_distribution<int> d{1, 2, 3, 0, 4, 10};
+    assert(d.min() == 0 && d.max() == 5);
+    threefry4x64 bulkeng({5}), scalareng({5});
+    const size_t N = 200000;
+    vector<int> bulk(N);
+    d.generate(bulkeng, bulk.begin(), bulk.end());
+    array<size_t, 6> hist{};
+    for(auto v : bulk){
+        assert(v == d(scalareng));
+        hist[v]++;
+    }
+    assert(bulkeng == scalareng);
+    assert(hist[3] == 0);
+    const double w[] = {1, 2, 3, 0, 4, 10};
+    for(size_t i=0; i<hist.size(); ++i){
+        double expected = N*w[i]/20.;
+        assert(abs(hist[i] - expected) < 5*sqrt(expected) + 1);
+    }
+
+    // Non-contiguous output and a non-counter-based engine.
+    mt19937_64 mt;
+    deque<int> dq(1000);
+    d.generate(mt, dq.begin(), dq.end());
+    assert(ranges::none_of(dq, [](int v){ return v == 3; }));
+
+    bool threw = false;
+    try{ alias_discrete_distribution<int>{0., 0.}; }catch(invalid_argument&){ threw = true; }
+    assert(threw);
+}
+
+// bernoulli_mask should set bits with the requested probability, and
+// splitting the work by counter range shouldn't change the result.
+void check_bernoulli_mask(){
+    const size_t nwords = 20000;
+    for(double p : {0., 1., 0.5, 0.25, 0.875, 0.3, 1./3.}){
+        bernoulli_mask bm(p);
+        assert(abs(bm.p() - p) <= 0x1p-33);
+        threefry4x64 eng({9});
+        vector<uint64_t> mask(nwords);
+        bm.generate(eng, mask.begin(), mask.end());
+        size_t ones = 0;
+        for(auto w : mask)
+            ones += popcount(w);
+        double nbits = 64.*nwords;
+        assert(abs(ones - nbits*p) <= 5*sqrt(nbits*p*(1-p)) + 1);
+
+        // Split into three pieces, as separate threads would.
+        vector<uint64_t> split(nwords);
+        threefry4x64 proto({9});
+        for(auto [first, last] : {pair<size_t, size_t>{0, 1000}, {1000, 1001}, {1001, nwords}}){
+            auto e = proto;
+            e.discard(first * bm.words_per_mask_word());
+            bm.generate(e, split.begin() + first, split.begin() + last);
+        }
+        assert(split == mask);
+    }
+    assert(bernoulli_mask::dyadic(3, 3).words_per_mask_word() == 3);
+    assert(bernoulli_mask::dyadic(4, 3).words_per_mask_word() == 1);   // 4/8 == 1/2
+    assert(bernoulli_mask(0.25).words_per_mask_word() == 2);
+}
+
+// The value of an fp16 bit pattern.
+double fp16_value(uint16_t h){
+    int e = (h >> 10) & 0x1f;
+    double m = h & 0x3ff;
+    double v = e == 0 ? ldexp(m, -24) : e == 31 ? (m ? NAN : INFINITY) : ldexp(1024 + m, e - 25);
+    return h & 0x8000 ? -v : v;
+}
+double bf16_value(uint16_t b){
+    return bit_cast<float>(uint32_t(b) << 16);
+}
+
+// Stochastic rounding should be unbiased, should only ever pick one of
+// the two neighbours, should leave representable values alone, and
+// should depend only on the key and the element's index.
+template <typename SR>
+void check_stochastic_rounding(){
+    SR sr({5, 6});
+    const size_t n = 1<<16;
+    vector<float> x(n);
+    vector<double> xd(n);
+    vector<uint16_t> h(n);
+    vector<float> f(n);
+    // Mean of n roundings of v, and the two values seen.
+    auto check_mean = [&](double v, auto&& vals){
+        double sum = 0., lo = INFINITY, hi = -INFINITY;
+        for(double r : vals){
+            sum += r;
+            lo = std::min(lo, r);
+            hi = std::max(hi, r);
+        }
+        // Each rounding is lo or hi, so the sd of the mean is at most
+        // (hi-lo)/(2 sqrt(n)).  The probability is exact to 2^-16.
+        assert(lo <= v && v <= hi);
+        assert(abs(sum/n - v) <= 5*(hi - lo)/(2*sqrt(double(n))) + (hi - lo)*0x1p-16);
+        return pair(lo, hi);
+    };
+    auto bf16s = [&](){ return h | views::transform(bf16_value); };
+    auto fp16s = [&](){ return h | views::transform(fp16_value); };
+    auto floats = [&](){ return f | views::transform([](float v){ return double(v); }); };
+
+    for(float v : {1.3f, -2.71828f, 1e-40f, 3e38f, 0x1.00ff7ep0f}){
+        ranges::fill(x, v);
+        sr.to_bf16(x.data(), h.data(), n);
+        check_mean(v, bf16s());
+        auto [mn, mx] = ranges::minmax(h);
+        assert(mx - mn <= 1);
+    }
+    for(float v : {1.3f, -1000.1f, 65500.f, 3e-5f, -1e-7f, 0x1p-26f}){
+        ranges::fill(x, v);
+        sr.to_fp16(x.data(), h.data(), n);
+        check_mean(v, fp16s());
+        auto [mn, mx] = ranges::minmax(h);
+        assert(mx - mn <= 1);
+    }
+    for(double v : {0.1, -1e30, 1e-40, 0x1p-151, 7e-46}){
+        ranges::fill(xd, v);
+        sr.to_fp32(xd.data(), f.data(), n);
+        auto [lo, hi] = check_mean(v, floats());
+        assert(nextafter(float(lo), INFINITY) >= hi || lo == hi);
+    }
+    for(double v : {0.1, 1e-39, -3*0x1p-136}){
+        ranges::fill(xd, v);
+        sr.to_bf16(xd.data(), h.data(), n);
+        check_mean(v, bf16s());
+        sr.to_fp16(xd.data(), h.data(), n);
+        if(v > 1e-30)
+            check_mean(v, fp16s());
+    }
+
+    // Representable values and special cases.
+    x = {1.f, -0.5f, 0.f, -0.f, 1024.f, INFINITY, -INFINITY, NAN, 65536.f, 1e30f};
+    sr.to_fp16(x.data(), h.data(), x.size());
+    assert((vector<uint16_t>(h.begin(), h.begin() + 8) ==
+            vector<uint16_t>{0x3c00, 0xb800, 0, 0x8000, 0x6400, 0x7c00, 0xfc00, 0x7e00}));
+    assert(h[8] == 0x7c00 && h[9] == 0x7c00);   // past the largest finite value
+    sr.to_bf16(x.data(), h.data(), x.size());
+    assert((vector<uint16_t>(h.begin(), h.begin() + 8) ==
+            vector<uint16_t>{0x3f80, 0xbf00, 0, 0x8000, 0x4480, 0x7f80, 0xff80, 0x7fc0}));
+    xd = {1.5, -0x1p-149, 0., numeric_limits<double>::max(), -NAN, 1e300, -INFINITY};
+    sr.to_fp32(xd.data(), f.data(), xd.size());
+    assert(f[0] == 1.5f && f[1] == -0x1p-149f && f[2] == 0.f);
+    assert(f[3] == INFINITY && isnan(f[4]) && signbit(f[4]));
+    assert(f[5] == INFINITY && f[6] == -INFINITY);
+    // Values far outside the subnormal range must not reach its
+    // float-to-int conversions (which would be undefined behaviour,
+    // e.g., under -fsanitize=float-cast-overflow).
+    x = {1e30f, -3e38f, INFINITY, -INFINITY};
+    sr.to_fp16(x.data(), h.data(), x.size());
+    assert((vector<uint16_t>(h.begin(), h.begin() + 4) ==
+            vector<uint16_t>{0x7c00, 0xfc00, 0x7c00, 0xfc00}));
+    xd = {1e300, -1e300, 1e30, INFINITY};
+    sr.to_fp16(xd.data(), h.data(), xd.size());
+    assert((vector<uint16_t>(h.begin(), h.begin() + 4) ==
+            vector<uint16_t>{0x7c00, 0xfc00, 0x7c00, 0x7c00}));
+    sr.to_bf16(xd.data(), h.data(), xd.size());
+    assert(h[0] == 0x7f80 && h[1] == 0xff80 && h[3] == 0x7f80);
+    assert(h[2] == 0x7149 || h[2] == 0x714a);   // 1e30 is between them
+
+    // Split among 'threads', with the index of each piece's first
+    // element.
+    x.resize(n);
+    xd.resize(n);
+    f.resize(n);
+    for(size_t i=0; i<n; ++i){
+        x[i] = 1.f + i*0x1p-20f;
+        xd[i] = 1. + i*0x1p-40;
+    }
+    vector<uint16_t> whole(n), whole_h(n);
+    vector<float> whole_f(n);
+    sr.to_bf16(x.data(), whole.data(), n);
+    sr.to_fp16(x.data(), whole_h.data(), n);
+    sr.to_fp32(xd.data(), whole_f.data(), n);
+    for(auto [lo, hi] : {pair<size_t, size_t>{0, 3}, {3, 1000}, {1000, 1001}, {1001, n}}){
+        sr.to_bf16(x.data() + lo, h.data() + lo, hi - lo, lo);
+        sr.to_fp32(xd.data() + lo, f.data() + lo, hi - lo, lo);
+    }
+    assert(h == whole && f == whole_f);
+    for(size_t lo : {size_t(0), size_t(7), n - 5}){
+        sr.to_fp16(x.data() + lo, h.data() + lo, n - lo, lo);
+        assert(ranges::equal(h | views::drop(lo), whole_h | views::drop(lo)));
+    }
+    // A different key rounds differently.
+    SR other({5, 7});
+    other.to_bf16(x.data(), h.data(), n);
+    assert(h != whole);
+}
+
+// apply and apply_transpose should agree with a dense R built from
+// R(i, j), for any number of threads, and the entries should have the
+// right distribution.
+template <typename RP>
+void check_random_projection(){
+    for(auto kind : {projection_kind::gaussian, projection_kind::rademacher, projection_kind::sparse}){
+        const size_t rows = 70, cols = 1300;   // not multiples of anything
+        const double scale = 0.25, s = 5.;
+        RP R({11, 12}, rows, cols, kind, scale, s);
+        assert(R.rows() == rows && R.cols() == cols);
+        vector<double> dense(rows*cols);
+        for(size_t i=0; i<rows; ++i)
+            for(size_t j=0; j<cols; ++j)
+                dense[i*cols + j] = R(i, j);
+        // Mean 0, variance scale^2, and the right values.
+        double sum = 0., sum2 = 0.;
+        size_t nonzero = 0;
+        for(double v : dense){
+            sum += v;
+            sum2 += v*v;
+            nonzero += v != 0.;
+            if(kind == projection_kind::rademacher)
+                assert(abs(v) == scale);
+            if(kind == projection_kind::sparse)
+                assert(v == 0. || abs(abs(v) - scale*sqrt(s)) < 1e-3*scale);
+        }
+        const double N = dense.size();
+        assert(abs(sum/N) < 5*scale*sqrt(s/N));
+        assert(abs(sum2/N/(scale*scale) - 1.) < (kind == projection_kind::sparse ? 0.05 : 0.02));
+        if(kind == projection_kind::sparse)
+            assert(abs(nonzero/N - 1/s) < 0.01);
+
+        vector<double> x(cols), y(rows), ref_y(rows, 0.), ref_x(cols, 0.);
+        for(size_t j=0; j<cols; ++j)
+            x[j] = sin(double(j));
+        for(size_t i=0; i<rows; ++i)
+            y[i] = cos(double(i));
+        for(size_t i=0; i<rows; ++i)
+            for(size_t j=0; j<cols; ++j){
+                ref_y[i] += dense[i*cols + j]*x[j];
+                ref_x[j] += dense[i*cols + j]*y[i];
+            }
+        vector<double> y1(rows), x1(cols);
+        R.apply(x.data(), y1.data(), 1);
+        R.apply_transpose(y.data(), x1.data(), 1);
+        for(size_t i=0; i<rows; ++i)
+            assert(abs(y1[i] - ref_y[i]) < 1e-9);
+        for(size_t j=0; j<cols; ++j)
+            assert(abs(x1[j] - ref_x[j]) < 1e-9);
+        for(unsigned threads : {2u, 3u, 0u}){
+            vector<double> yt(rows), xt(cols);
+            R.apply(x.data(), yt.data(), threads);
+            R.apply_transpose(y.data(), xt.data(), threads);
+            assert(yt == y1 && xt == x1);
+        }
+        // Another key is another matrix.
+        RP other({13, 12}, rows, cols, kind, scale, s);
+        vector<double> y2(rows);
+        other.apply(x.data(), y2.data());
+        assert(y2 != y1);
+    }
+    bool threw = false;
+    try{ RP bad({1}, 2, 2, projection_kind::sparse, 1., 0.5); }catch(invalid_argument&){ threw = true; }
+    assert(threw);
+}
+
+// A compact engine should produce the same sequence as the
+// corresponding counter_based_engine, through any mix of calls, in
+// less space.
+template <typename CompactT, typename EngT>
+void check_compact(){
+    static_assert(sizeof(CompactT) < sizeof(EngT));
+    EngT eng({3, 1, 4});
+    CompactT ceng({3, 1, 4});
+    vector<typename EngT::result_type> a(37), b(37);
+    for(int iter=0; iter<20; ++iter){
+        assert(eng() == ceng());
+        size_t len = (iter*7) % a.size();
+        eng(a.begin(), a.begin()+len);
+        ceng(b.begin(), b.begin()+len);
+        assert(ranges::equal(a.begin(), a.begin()+len, b.begin(), b.begin()+len));
+        eng.discard(iter);
+        ceng.discard(iter);
+    }
+    deque<typename EngT::result_type> dq(b.size());
+    eng(a.begin(), a.end());
+    ceng(dq.begin(), dq.end());
+    assert(ranges::equal(a, dq));
+
+    ostringstream oss;
+    oss << ceng;
+    CompactT restored;
+    assert(restored != ceng);
+    istringstream iss(oss.str());
+    iss >> restored;
+    assert(restored == ceng);
+    assert(restored() == eng());
+}
+
+// Threads drawing from a shared engine should, between them, get every
+// value of the stream exactly once.
+template <typename SharedT, typename EngT>
+void check_shared(){
+    using result_type = EngT::result_type;
+    SharedT shared({2, 7});
+    const int nthreads = 4;
+    const size_t per_thread = 5000;
+    vector<vector<result_type>> got(nthreads);
+    vector<thread> threads;
+    for(int t=0; t<nthreads; ++t)
+        threads.emplace_back([&, t](){
+            auto& mine = got[t];
+            mine.resize(per_thread);
+            for(size_t i=0; i<per_thread; ){
+                if(i%3 == 0){
+                    mine[i++] = shared();
+                }else{
+                    size_t n = std::min<size_t>(1 + i%97, per_thread - i);
+                    shared(mine.begin()+i, mine.begin()+i+n);
+                    i += n;
+                }
+            }
+        });
+    for(auto& th : threads)
+        th.join();
+    assert(shared.values_reserved() == nthreads*per_thread);
+
+    vector<result_type> all;
+    for(auto& v : got)
+        all.insert(all.end(), v.begin(), v.end());
+    vector<result_type> expected(all.size());
+    EngT({2, 7})(expected.begin(), expected.end());
+    ranges::sort(all);
+    ranges::sort(expected);
+    assert(all == expected);
+
+    // Buffered local_engines that draw whole buffers get the next
+    // values of the stream.
+    static_assert(uniform_random_bit_generator<typename SharedT::local_engine>);
+    const size_t per_local = 3*SharedT::buffer_count;
+    vector<vector<result_type>> got_local(nthreads);
+    threads.clear();
+    for(int t=0; t<nthreads; ++t)
+        threads.emplace_back([&, t](){
+            auto local = shared.local();
+            for(size_t i=0; i<per_local; ++i)
+                got_local[t].push_back(local());
+        });
+    for(auto& th : threads)
+        th.join();
+    assert(shared.values_reserved() == nthreads*(per_thread + per_local));
+    all.clear();
+    for(auto& v : got_local)
+        all.insert(all.end(), v.begin(), v.end());
+    EngT eng({2, 7});
+    eng.discard(nthreads*per_thread);
+    expected.resize(all.size());
+    eng(expected.begin(), expected.end());
+    ranges::sort(all);
+    ranges::sort(expected);
+    assert(all == expected);
+}
+
+// Several processes draw from one shm_counter_based_engine stream.  One
+// of them 'crashes' (exits) in the middle of a range.  The values the
+// survivors got must be distinct and must all come from the first
+// reserved() values of the stream.
+void check_counter_range_allocator(){
+    using result_type = philox4x64::result_type;
+    string name = "/cbe-tests-" + to_string(getpid());
+    counter_range_allocator::remove(name);
+    const int nprocs = 4;
+    const size_t per_proc = 3000;
+    const uint64_t chunk = 700;
+    // Each process writes into its own slice of a shared mapping.
+    size_t bytes = nprocs * per_proc * sizeof(result_type);
+    void* p = mmap(nullptr, bytes, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_ANONYMOUS, -1, 0);
+    assert(p != MAP_FAILED);
+    auto results = static_cast<result_type*>(p);
+    vector<pid_t> kids;
+    for(int i=0; i<nprocs; ++i){
+        pid_t pid = fork();
+        assert(pid >= 0);
+        if(pid == 0){
+            shm_counter_based_engine<philox4x64_prf, 1> eng(name, {3, 1, 4}, chunk);
+            result_type* mine = results + i*per_proc;
+            if(i == 0){
+                // Take part of a range, then die.
+                eng(mine, mine + chunk/2);
+                _exit(0);
+            }
+            for(size_t j=0; j<per_proc; ){
+                if(j%5 == 0){
+                    mine[j++] = eng();
+                }else{
+                    size_t n = std::min<size_t>(1 + j%300, per_proc - j);
+                    eng(mine + j, mine + j + n);
+                    j += n;
+                }
+            }
+            _exit(0);
+        }
+        kids.push_back(pid);
+    }
+    for(auto pid : kids){
+        int status;
+        assert(waitpid(pid, &status, 0) == pid && WIFEXITED(status) && WEXITSTATUS(status) == 0);
+    }
+
+    // A later attach continues where the others left off.
+    shm_counter_based_engine<philox4x64_prf, 1> eng(name, {3, 1, 4}, chunk);
+    uint64_t reserved = eng.allocator().reserved();
+    assert(reserved % chunk == 0 && reserved >= (nprocs-1)*per_proc + chunk/2);
+    result_type more[10];
+    eng(begin(more), end(more));
+    assert(eng.allocator().reserved() == reserved + chunk);
+    // A different key can't attach to the same segment.
+    bool threw = false;
+    try{
+        shm_counter_based_engine<philox4x64_prf, 1> other(name, {2, 7});
+    }catch(invalid_argument&){
+        threw = true;
+    }
+    assert(threw);
+
+    // Process 0 only wrote the first chunk/2 of its slice.
+    vector<result_type> got(results, results + chunk/2);
+    got.insert(got.end(), results + per_proc, results + nprocs*per_proc);
+    got.insert(got.end(), begin(more), end(more));
+    ranges::sort(got);
+    assert(ranges::adjacent_find(got) == got.end());
+    vector<result_type> stream(reserved + chunk);
+    compact_philox4x64({3, 1, 4})(stream.begin(), stream.end());
+    ranges::sort(stream);
+    for(auto v : got)
+        assert(ranges::binary_search(stream, v));
+    munmap(p, bytes);
+    counter_range_allocator::remove(name);
+}
+
+// Every byte of a random file should be the little-endian bytes of
+// the engine's values, whatever the threads, chunks and I/O method, and
+// any region should be regenerable by itself.
+template <typename Eng>
+void check_random_file(){
+    Eng proto({11, 22});
+    constexpr size_t vbytes = Eng::word_size/8;
+    const size_t nbytes = 3*4096 + 1234;
+    vector<unsigned char> expected(nbytes);
+    Eng e = proto;
+    for(size_t i=0; i<nbytes; i += vbytes){
+        auto v = e();
+        for(size_t j=0; j<vbytes && i+j<nbytes; ++j)
+            expected[i+j] = (unsigned char)(v >> (8*j));
+    }
+    vector<unsigned char> got(nbytes + 1);
+    for(size_t off : {0, 1, 3, 7, 8, 13, 4095, 4096})
+        for(size_t n : {0, 1, 2, 5, 9, 17, 4000}){
+            // Through an unaligned buffer, too.
+            for(size_t mis : {0, 1}){
+                ranges::fill(got, 0);
+                random_fill_bytes(proto, off, got.data() + mis, n);
+                assert(equal(got.begin() + mis, got.begin() + mis + n, expected.begin() + off));
+            }
+        }
+
+    string file = "/tmp/random-file-tests." + to_string(getpid());
+    random_file_options one;
+    one.threads = 1;
+    random_file_create(file, nbytes, proto, one);
+    random_file_options many;
+    many.threads = 3;
+    many.chunk_bytes = 4096;
+    int fd = open(file.c_str(), O_RDWR);
+    assert(fd >= 0);
+    auto contents = [&](){
+        vector<unsigned char> v(nbytes + 10);
+        v.resize(pread(fd, v.data(), v.size(), 0));
+        return v;
+    };
+    assert(contents() == expected);
+    assert(random_file_verify(fd, proto, 0, nbytes, many) == UINT64_MAX);
+    // A missing byte, past the end, is a difference.
+    assert(random_file_verify(fd, proto, 0, nbytes + 1, many) == nbytes);
+    for(bool use_mmap : {true, false}){
+        many.use_mmap = use_mmap;
+        assert(ftruncate(fd, 0) == 0);
+        random_file_fill(fd, proto, 0, nbytes, many);
+        assert(contents() == expected);
+        // Damage some bytes, and repair them by offset.
+        unsigned char junk[100];
+        for(size_t i=0; i<sizeof(junk); ++i)
+            junk[i] = ~expected[4090 + i];
+        assert(pwrite(fd, junk, sizeof(junk), 4090) == sizeof(junk));
+        assert(random_file_verify(fd, proto, 0, nbytes, many) == 4090);
+        assert(random_file_verify(fd, proto, 4190, nbytes - 4190, many) == UINT64_MAX);
+        random_file_fill(fd, proto, 4090, sizeof(junk), many);
+        assert(contents() == expected);
+    }
+    // A write-only descriptor can't be mapped, so it gets pwrite.
+    int wfd = open(file.c_str(), O_WRONLY);
+    assert(wfd >= 0 && ftruncate(wfd, 0) == 0);
+    random_file_fill(wfd, proto, 0, nbytes, random_file_options{});
+    close(wfd);
+    assert(contents() == expected);
+    close(fd);
+    unlink(file.c_str());
+}
+
+// Every kernel variant of a prf should produce the same results as
+// plain generate, for every number of blocks, i.e., with every size of
+// final partial (padded or scalar) simd group.
+template <typename PRF>
+void check_kernel_variants(){
+    using in_type = array<typename PRF::input_value_type, PRF::input_count>;
+    vector<in_type> ins(37);
+    for(size_t i=0; i<ins.size(); ++i){
+        ins[i].fill(i*3 + 1);
+        ins[i][0] = i;
+    }
+    auto inrange = ins | views::transform([](const in_type& a){ return a.begin(); });
+    vector<typename PRF::output_value_type> expected(ins.size()*PRF::output_count), got(expected.size());
+    PRF{}.generate(kernel_variant{0}, inrange, expected.begin());
+    for(size_t k=0; k<=ins.size(); ++k){
+        auto part = inrange | views::take(k);
+        const size_t nk = k*PRF::output_count;
+        ranges::fill(got, 0);
+        PRF{}.generate(part, got.begin());
+        assert(ranges::equal(got | views::take(nk), expected | views::take(nk)));
+        for(auto v : PRF::kernel_variants){
+            ranges::fill(got, 0);
+            PRF{}.generate(kernel_variant{v}, part, got.begin());
+            assert(ranges::equal(got | views::take(nk), expected | views::take(nk)));
+            assert(ranges::all_of(got | views::drop(nk), [](auto x){ return x == 0; }));
+        }
+        got.clear();
+        PRF{}.for_each_block(part, [&](auto s){ got.insert(got.end(), s.begin(), s.end()); });
+        assert(ranges::equal(got, expected | views::take(nk)));
+        got.resize(expected.size());
+    }
+}
+
+#if PRF_AUTOTUNE
+// prf_autotune should pick valid candidates, and remember them.
+template <typename PRF>
+void check_autotune(const string& file){
+    auto t = prf_autotune<PRF>(file);
+    assert(detail::autotune_valid<PRF>(t));
+    auto again = prf_autotune<PRF>(file);
+    assert(again.kernel_variant == t.kernel_variant && again.staging_bytes == t.staging_bytes);
+    ifstream ifs(file);
+    string line;
+    size_t n = 0;
+    while(getline(ifs, line))
+        n += line.starts_with(detail::autotune_key<PRF>() + " ");
+    assert(n == 1);
+}
+#endif // PRF_AUTOTUNE
+
+// Widynski's squares32 and squares64, transcribed from the paper.
+uint32_t squares32_ref(uint64_t ctr, uint64_t key){
+    uint64_t x, y, z;
+    y = x = ctr * key; z = y + key;
+    x = x*x + y; x = (x>>32) | (x<<32);
+    x = x*x + z; x = (x>>32) | (x<<32);
+    x = x*x + y; x = (x>>32) | (x<<32);
+    return (x*x + z) >> 32;
+}
+uint64_t squares64_ref(uint64_t ctr, uint64_t key){
+    uint64_t t, x, y, z;
+    y = x = ctr * key; z = y + key;
+    x = x*x + y; x = (x>>32) | (x<<32);
+    x = x*x + z; x = (x>>32) | (x<<32);
+    x = x*x + y; x = (x>>32) | (x<<32);
+    t = x = x*x + z; x = (x>>32) | (x<<32);
+    return t ^ ((x*x + y) >> 32);
+}
+
+// squares_prf's bulk generate (simd groups, a scalar tail, keys that
+// change part way through) should match the reference.
+template <typename PRF, typename F>
+void check_squares(F ref){
+    const size_t n = 37;
+    vector<array<uint64_t, 2>> ins(n);
+    for(size_t i=0; i<n; ++i)
+        ins[i] = {i*0x1234567 + 5, i < 20 ? 42u : i/3};
+    vector<typename PRF::output_value_type> out(n);
+    deque<typename PRF::output_value_type> dout(n);
+    auto inrange = ins | views::transform([](const auto& a){ return a.begin(); });
+    PRF{}.generate(inrange, out.begin());
+    PRF{}.generate(inrange, dout.begin());
+    for(size_t i=0; i<n; ++i){
+        auto expected = ref(ins[i][0], PRF::key_schedule(ins[i][1]));
+        assert(out[i] == expected && dout[i] == expected);
+        typename PRF::output_value_type one;
+        PRF{}(ins[i].begin(), &one);
+        assert(one == expected);
+    }
+}
+
+// The C API should deliver the C++ engines' values, at any position.
+template <typename Eng>
+void check_c_api(cbe_kind kind){
+    using T = conditional_t<Eng::word_size == 32, uint32_t, uint64_t>;
+    vector<uint64_t> key = {3, 1, 4, 1, 5, 9, 2, 6};
+    size_t nkey = cbe_key_words(kind);
+    assert(nkey == Eng::seed_count && cbe_word_size(kind) == int(Eng::word_size));
+    key.resize(nkey);
+    cbe_engine* e = cbe_create(kind, key.data(), nkey);
+    assert(e);
+    const size_t n = 1000, first = 77;
+    vector<T> got(n);
+    auto fill = [&](uint64_t f, T* out, size_t m){
+        if constexpr (Eng::word_size == 32)
+            return cbe_fill_u32(e, f, out, m);
+        else
+            return cbe_fill_u64(e, f, out, m);
+    };
+    assert(fill(first, got.data(), n) == CBE_OK);
+    // A view of key, not a copy:  gcc 12 warns, wrongly, about freeing
+    // the copy (-Wfree-nonheap-object).
+    Eng eng(views::all(key));
+    eng.discard(first);
+    for(auto v : got)
+        assert(v == eng());
+    // Pieces agree with the whole.
+    vector<T> piece(10);
+    assert(fill(first + 123, piece.data(), piece.size()) == CBE_OK);
+    assert(ranges::equal(piece, got | views::drop(123) | views::take(10)));
+
+    vector<double> d(n);
+    assert(cbe_fill_double(e, 5, d.data(), n) == CBE_OK);
+    for(auto x : d)
+        assert(x >= 0. && x < 1.);
+    double d5;
+    cbe_fill_double(e, 5+7, &d5, 1);
+    assert(d5 == d[7]);
+    // The wrong width, too many key words, an unknown kind.
+    uint32_t u32;
+    uint64_t u64;
+    assert((Eng::word_size == 32 ? cbe_fill_u64(e, 0, &u64, 1) : cbe_fill_u32(e, 0, &u32, 1)) == CBE_EWORDSIZE);
+    key.push_back(0);
+    assert(cbe_create(kind, key.data(), key.size()) == nullptr);
+    assert(cbe_create(cbe_kind(99), key.data(), 1) == nullptr);
+    cbe_engine* e2 = e;
+    assert(cbe_create_checked(kind, key.data(), key.size(), &e2) == CBE_EINVAL && e2 == nullptr);
+    assert(cbe_create_checked(cbe_kind(99), key.data(), 1, &e2) == CBE_EINVAL && e2 == nullptr);
+    assert(cbe_create_checked(kind, key.data(), 1, &e2) == CBE_OK && e2);
+    cbe_destroy(e2);
+    assert(cbe_fill_u64(nullptr, 0, &u64, 1) == CBE_EINVAL);
+    cbe_destroy(e);
+}
+
 int main(int argc, char **argv){
+    // If tuning, don't cache the results in the user's file.
+    setenv("PRF_AUTOTUNE_FILE", "", 1);
     // Known-answer tests from the original Random123 distribution.
     // The format is:  in[0 .. in_N] result[0 .. result_N]
     dokat<threefry2x32_prf_r<20>, 2>("00000000 00000000 00000000 00000000   6b200159 99ba4efe");
@@ -88,6 +1121,124 @@ int main(int argc, char **argv){
     dokat<philox4x32_prf_r<10>, 2>("243f6a88 85a308d3 13198a2e 03707344 a4093822 299f31d0   d16cfe09 94fdcceb 5001e420 24126ea1");
     cout << "PASSED: known-answer-tests" << endl;
 
+    const int rot512[8][4] = {{46, 36, 19, 37}, {33, 27, 14, 42}, {17, 49, 36, 39}, {44,  9, 54, 56},
+                              {39, 30, 34, 24}, {13, 50, 10, 17}, {25, 29, 39, 43}, { 8, 35, 56, 22}};
+    const size_t pi512[8] = {2, 1, 4, 7, 6, 5, 0, 3};
+    check_threefish<threefry8x64_prf, 72>(rot512, pi512);
+    check_threefish<threefry8x64_prf_r<20>, 20>(rot512, pi512);
+    const int rot1024[8][8] = {{24, 13,  8, 47,  8, 17, 22, 37}, {38, 19, 10, 55, 49, 18, 23, 52},
+                               {33,  4, 51, 13, 34, 41, 59, 17}, { 5, 20, 48, 41, 47, 28, 16, 25},
+                               {41,  9, 37, 31, 12, 47, 44, 30}, {16, 34, 56, 51,  4, 53, 42, 41},
+                               {31, 44, 47, 46, 19, 42, 44, 25}, { 9, 48, 35, 52, 23, 31, 37, 20}};
+    const size_t pi1024[16] = {0, 9, 2, 13, 6, 11, 4, 15, 10, 7, 12, 3, 14, 5, 8, 1};
+    check_threefish<threefry16x64_prf, 80>(rot1024, pi1024);
+    check_threefish<threefry16x64_prf_r<20>, 20>(rot1024, pi1024);
+
+    check_bulk<threefry8x64>();
+    check_bulk<threefry16x64>();
+    cout << "PASSED: wide threefry bulk tests" << endl;
+    check_bulk<threefry4x64>();
+    check_bulk<threefry2x32>();
+    check_bulk<philox4x64>();
+    cout << "PASSED: contiguous/staged bulk tests" << endl;
+    check_unordered<threefry4x64>();
+    check_unordered<threefry2x32>();
+    check_unordered<threefry16x64>();
+    check_unordered<philox4x64>();
+    cout << "PASSED: unordered bulk tests" << endl;
+    check_for_each_block<threefry4x64>();
+    check_for_each_block<threefry2x32>();
+    check_for_each_block<threefry16x64>();
+    check_for_each_block<philox4x64>();
+    check_for_each_block<squares32>();
+    check_for_each_block<squares64>();
+    cout << "PASSED: for_each_block tests" << endl;
+    check_view<threefry4x64>();
+    check_view<threefry2x32>();
+    check_view<philox4x64>();
+    cout << "PASSED: counter_based_view tests" << endl;
+    check_permutation<counter_based_permutation<>>();
+    check_permutation<counter_based_permutation<philox4x32_prf, 6>>();
+    cout << "PASSED: counter_based_permutation tests" << endl;
+    check_grid<counter_based_grid<philox4x64_prf, 3>>(1);
+    check_grid<counter_based_grid<philox4x64_prf, 3>>(3);
+    check_grid<counter_based_grid<philox4x64_prf, 3>>(8);
+    check_grid<counter_based_grid<threefry4x64_prf, 3>>(5);
+    check_grid<counter_based_grid<philox2x32_prf, 3>>(2);
+    check_grid<counter_based_grid<threefry2x32_prf, 3>>(7);
+    {
+        // The fields must fit in the counter:  2*32 bits for philox2x32.
+        bool threw = false;
+        try{ counter_based_grid<philox2x32_prf, 3> g({1}, {20, 20, 20}); }catch(invalid_argument&){ threw = true; }
+        assert(threw);
+        counter_based_grid<philox2x32_prf, 3> ok({1}, {20, 11, 32});
+    }
+    cout << "PASSED: counter_based_grid tests" << endl;
+    check_alias_distribution();
+    cout << "PASSED: alias_discrete_distribution tests" << endl;
+    check_bernoulli_mask();
+    cout << "PASSED: bernoulli_mask tests" << endl;
+    check_stochastic_rounding<stochastic_rounder<>>();
+    check_stochastic_rounding<stochastic_rounder<philox4x32_prf, 2>>();
+    cout << "PASSED: stochastic rounding tests" << endl;
+    check_random_projection<random_projection<>>();
+    check_random_projection<random_projection<philox2x64_prf>>();
+    check_random_projection<random_projection<threefry16x64_prf>>();
+    cout << "PASSED: random projection tests" << endl;
+    check_compact<compact_philox4x64, philox4x64>();
+    check_compact<compact_philox2x32, philox2x32>();
+    check_compact<compact_threefry4x64, threefry4x64>();
+    check_compact<compact_threefry2x32, threefry2x32>();
+    cout << "PASSED: compact engine tests" << endl;
+    check_shared<shared_philox4x64, philox4x64>();
+    check_shared<shared_threefry4x64, threefry4x64>();
+    cout << "PASSED: shared engine tests" << endl;
+    check_counter_range_allocator();
+    cout << "PASSED: counter range allocator tests" << endl;
+    check_random_file<compact_threefry4x64>();
+    check_random_file<compact_philox4x32>();
+    check_random_file<compact_counter_based_engine<squares32_prf, 1>>();
+    cout << "PASSED: random file tests" << endl;
+    check_kernel_variants<threefry2x32_prf>();
+    check_kernel_variants<threefry4x32_prf>();
+    check_kernel_variants<threefry4x64_prf>();
+    check_kernel_variants<threefry16x64_prf>();
+#if PRF_AUTOTUNE
+    {
+        string file = "/tmp/prf-autotune-tests." + to_string(getpid()) + ".txt";
+        check_autotune<threefry4x64_prf>(file);
+        check_autotune<philox4x64_prf>(file);
+        remove(file.c_str());
+    }
+    cout << "PASSED: autotune tests" << endl;
+#endif
+    check_squares<squares32_prf>(squares32_ref);
+    check_squares<squares64_prf>(squares64_ref);
+    {
+        // The engine's values are the prf's for counters 0, 1, 2, ...
+        squares64 eng({9});
+        for(uint64_t i=0; i<10; ++i)
+            assert(eng() == squares64_ref(i, squares64_prf::key_schedule(9)));
+    }
+    // One value per block is a corner case for the engines.
+    check_compact<compact_counter_based_engine<squares32_prf, 1>, squares32>();
+    check_compact<compact_counter_based_engine<squares64_prf, 1>, squares64>();
+    cout << "PASSED: squares tests" << endl;
+    assert(cbe_abi_version() == CBE_ABI_VERSION);
+    check_c_api<philox2x32>(CBE_PHILOX2X32);
+    check_c_api<philox4x32>(CBE_PHILOX4X32);
+    check_c_api<philox2x64>(CBE_PHILOX2X64);
+    check_c_api<philox4x64>(CBE_PHILOX4X64);
+    check_c_api<threefry2x32>(CBE_THREEFRY2X32);
+    check_c_api<threefry4x32>(CBE_THREEFRY4X32);
+    check_c_api<threefry2x64>(CBE_THREEFRY2X64);
+    check_c_api<threefry4x64>(CBE_THREEFRY4X64);
+    cout << "PASSED: C API tests" << endl;
+#if PRF_INSTRUMENT
+    check_counters();
+    cout << "PASSED: instrumentation counters" << endl;
+#endif
+
     // Test discard and bulk generation - by far the trickiest corners
     // of the counter_based_engine implementation...
     eng_t jumpeng;
@@ -99,27 +1250,14 @@ int main(int argc, char **argv){
     eng_t eng3;
     const size_t max_jump = 10000;
     vector<eng_t::result_type> bulk(max_jump);
-#if PRF_ALLOW_PERMUTED_RESULTS
-    vector<eng_t::result_type> bulk2(max_jump);
-#endif
     for(size_t i=0; i<1000000; ++i){
         size_t jump = min(max_jump, size_t(abs(cd(jumpeng))));
         
         eng1(&bulk[0], &bulk[jump]);
         for(size_t j=0; j<jump; ++j){
             auto r = eng2();
-#if PRF_ALLOW_PERMUTED_RESULTS
-            bulk2[j] = r;
-#else
             assert(r == bulk[j]);
-#endif
         }
-#if PRF_ALLOW_PERMUTED_RESULTS
-        sort(&bulk2[0], &bulk2[jump]);
-        sort(&bulk[0], &bulk[jump]);
-        for(size_t j=0; j<jump; ++j)
-            assert(bulk[j] == bulk2[j]);
-#endif
         eng3.discard(jump);
         assert(eng1 == eng2);
         assert(eng1 == eng3);
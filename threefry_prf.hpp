@@ -1,23 +1,26 @@
 #pragma once
 
 #include "detail.hpp"
+#include "prf_counters.hpp"
+#include "autotune.hpp"
 #include <cstdint>
+#include <algorithm>
 #include <array>
 #include <bit>
 #include <ranges>
-
-// If the "parallel" API allows the results to be returned permuted,
-// we can write entire simd vectors to the output range.  This *might*
-// allow for some additional optimization (but in practice, with gcc10
-// on x86_64 with AVX-512, it seems not to make any difference)
-#ifndef PRF_ALLOW_PERMUTED_RESULTS
-#define PRF_ALLOW_PERMUTED_RESULTS 1
-#endif
-
-// Set SIMD_SIZE_BYTES to 0 to completely turn off SIMD.
-#ifndef PRF_SIMD_SIZE_BYTES
-// N.B. 32 bytes <-> AVX2, 64 bytes <-> AVX512
-#define PRF_SIMD_SIZE_BYTES 64
+#include <utility>
+#include <cstring>
+#include <iterator>
+#include <span>
+
+// PRF_ALLOW_PERMUTED_RESULTS used to change the order of *every*
+// call to generate in the translation unit.  Callers that don't care
+// about order now ask for it explicitly with the unordered_results
+// overload of generate (or counter_based_engine::fill_unordered).
+// -DPRF_ALLOW_PERMUTED_RESULTS=0 asked for the canonical order, which
+// is what everyone gets now, so only a non-zero value is an error.
+#if PRF_ALLOW_PERMUTED_RESULTS
+#error "PRF_ALLOW_PERMUTED_RESULTS is gone.  Use generate(unordered_results, in, out) instead."
 #endif
 
 #pragma GCC diagnostic push
@@ -28,12 +31,120 @@ namespace std{
 template<unsigned_integral UIntType, size_t  w, size_t n, size_t R, UIntType ks_parity, int ... consts>
 class threefry_prf {
     static_assert(w <= numeric_limits<UIntType>::digits);
-    static_assert( n==2 || n==4, "N must be 2 or 4" );
+    static_assert( n==2 || n==4 || n==8 || n==16, "N must be 2, 4, 8 or 16" );
     static_assert(sizeof ...(consts) == 4*n);
-    static_assert(R<=20, "loops are manually unrolled to R=20 only");
 
+    // rotation_constants[8*j + r%8] is the rotation applied to the
+    // j'th pair of words in round r.
     static constexpr array<int, 4*n> rotation_constants = {consts ...};
 
+    // The word permutation applied after every round.  These are the
+    // permutations from the Threefish specification <FIXME REF>.
+    static constexpr auto permutation = [](){
+        if constexpr (n == 2)
+            return array<size_t, 2>{0, 1};
+        else if constexpr (n == 4)
+            return array<size_t, 4>{0, 3, 2, 1};
+        else if constexpr (n == 8)
+            return array<size_t, 8>{2, 1, 4, 7, 6, 5, 0, 3};
+        else
+            return array<size_t, 16>{0, 9, 2, 13, 6, 11, 4, 15, 10, 7, 12, 3, 14, 5, 8, 1};
+    }();
+
+    // We never actually move words around to implement the
+    // permutation.  Instead, slot[r][i] says which of the n
+    // variables holds the i'th word at the beginning of round r.
+    // The permutations all have order 1, 2 or 4, and the rotation
+    // constants repeat every 8 rounds, so the schedule of rounds
+    // 8j to 8j+7 is the same for every j, and slot[4*s] is the
+    // identity.
+    static constexpr auto slot = [](){
+        array<array<size_t, n>, std::max<size_t>(R, 8)+1> ret;
+        for(size_t i=0; i<n; ++i)
+            ret[0][i] = i;
+        for(size_t r=0; r+1<ret.size(); ++r)
+            for(size_t i=0; i<n; ++i)
+                ret[r+1][i] = ret[r][permutation[i]];
+        return ret;
+    }();
+
+    // generate_impl<ordered, vb> computes vb/sizeof(UIntType) blocks at
+    // a time in the lanes of gcc vectors, simd_type<vb>, that are vb
+    // bytes wide.  vb == 0 means scalar code only.  vb is simd_size,
+    // unless the caller asks for another kernel_variant.
+    // N.B.  simd_size=64 gives some spurious warnings about 64-byte alignment
+    static constexpr size_t simd_size = PRF_SIMD_SIZE_BYTES;
+    template <size_t vb>
+    static constexpr size_t simd_N = vb/sizeof(UIntType);
+    template <size_t vb>
+    using simd_type = detail::simd_vec<UIntType, vb>::type;
+    // Fewer than simd_N<vb> blocks left over are computed in one
+    // zero-padded vector, with the padding lanes' results dropped,
+    // if there are at least min_padded<vb> of them.  Otherwise, the
+    // scalar code is faster.  (On AVX-512, the crossover is about 3
+    // blocks for n >= 4.  For n == 2, the scalar code is cheap enough
+    // that padding never paid for itself, so it's off.)
+    template <size_t vb>
+    static constexpr size_t min_padded = n == 2 ? simd_N<vb> : std::min<size_t>(3, simd_N<vb>);
+
+    // store_block writes the n*simd_N results in c to p.  If ordered,
+    // they're in the same order as the scalar code would have written
+    // them, i.e., lane s of c[i] goes to p[s*n + i].  That's a
+    // transpose, which we do in
+    // registers with __builtin_shuffle (another non-standard gcc
+    // extension) so that every store is a whole (unaligned) simd
+    // vector.
+    //
+    // The m'th output vector gathers lanes from min(n, simd_N)
+    // consecutive c's, starting with c[first_src(m)].  It's assembled
+    // by shuffling in one more c at a time.  On step t, lanes that
+    // came from earlier c's stay where they are, and lanes that come
+    // from the t'th c are picked out of it.
+    template <size_t vb>
+    static constexpr size_t first_src(size_t m){
+        return (m*simd_N<vb>)%n;
+    }
+    template <size_t vb>
+    static constexpr UIntType shuffle_index(size_t m, size_t t, size_t l){
+        size_t g = m*simd_N<vb> + l;
+        size_t rel = (g%n + n - first_src<vb>(m))%n;
+        size_t srclane = g/n;
+        if(rel < t)
+            return t==1 ? srclane : l;
+        if(rel == t)
+            return simd_N<vb> + srclane;
+        return 0; // don't care
+    }
+
+    template <size_t vb, size_t m, size_t t, size_t ... l>
+    [[gnu::always_inline]] static inline simd_type<vb> shuffle_step(simd_type<vb> acc, simd_type<vb> src, index_sequence<l...>){
+        return __builtin_shuffle(acc, src, simd_type<vb>{shuffle_index<vb>(m, t, l)...});
+    }
+
+    template <size_t vb, size_t m, size_t ... t>
+    [[gnu::always_inline]] static inline void store_vector(const array<simd_type<vb>, n>& c, void* p, index_sequence<t...>){
+        simd_type<vb> acc = c[first_src<vb>(m)];
+        ((acc = shuffle_step<vb, m, t+1>(acc, c[(first_src<vb>(m)+t+1)%n], make_index_sequence<simd_N<vb>>{})), ...);
+        memcpy(static_cast<char*>(p) + m*sizeof(simd_type<vb>), &acc, sizeof(simd_type<vb>));
+    }
+
+    template <size_t vb, size_t ... m>
+    [[gnu::always_inline]] static inline void store_vectors(const array<simd_type<vb>, n>& c, void* p, index_sequence<m...>){
+        (store_vector<vb, m>(c, p, make_index_sequence<std::min(n, simd_N<vb>)-1>{}), ...);
+    }
+
+    template <bool ordered, size_t vb>
+    static void store_block(const array<simd_type<vb>, n>& c, void* p){
+        if constexpr (ordered){
+            store_vectors<vb>(c, p, make_index_sequence<n>{});
+        }else{
+            // If we're allowed to permute the outputs, we don't have to
+            // transpose.  Just write the simd vectors one after another.
+            for(size_t i=0; i<n; ++i)
+                memcpy(static_cast<char*>(p) + i*sizeof(simd_type<vb>), &c[i], sizeof(simd_type<vb>));
+        }
+    }
+
     // The static methods are all templated on a Uint.  The
     // only instantiations will be with Uint=UIntType or
     // with Uint = a simd vector of UIntType.
@@ -42,130 +153,81 @@ class threefry_prf {
         return ((x<<r) | (x>>(w-r))) & inmask;
     }
 
-    template <unsigned r, typename Uint>
-    static inline void round2(Uint& c0, Uint& c1){
-        c0 = (c0 + c1)&inmask; c1 = rotleft(c1,rotation_constants[r%8]); c1 ^= c0;
+    template <size_t a, size_t b, int rot, typename Uint>
+    [[gnu::always_inline]] static inline void mix(array<Uint, n>& c){
+        c[a] = (c[a] + c[b])&inmask; c[b] = rotleft(c[b], rot); c[b] ^= c[a];
     }
-    template <typename Uint>
-    static void keymix2(Uint& c0, Uint& c1, Uint kk0, Uint kk1, unsigned r4){
-        c0 = (c0 + kk0) & inmask; 
-        c1 = (c1 + kk1 + r4) & inmask;
+
+    template <size_t r, typename Uint, size_t ... j>
+    [[gnu::always_inline]] static inline void round(array<Uint, n>& c, index_sequence<j...>){
+        (mix<slot[r][2*j], slot[r][2*j+1], rotation_constants[8*j + r%8]>(c), ...);
     }
 
-    template <typename Uint>
-    static inline void do2(Uint& cc0, Uint& cc1, Uint k0, Uint k1){
-        auto c0 = cc0, c1 = cc1;
-        Uint k2 = k0 ^ k1 ^ ks_parity;
-        keymix2(c0, c1, k0, k1, 0);
-
-        // Surprisingly(?), gcc (through gcc10) doesn't unroll the
-        // loop.  If we unroll it ourselves, it's about twice as fast.
-        if(R>0) round2<0>(c0, c1);
-        if(R>1) round2<1>(c0, c1);
-        if(R>2) round2<2>(c0, c1);
-        if(R>3) round2<3>(c0, c1);
-        if(R>3) keymix2(c0, c1, k1, k2, 1);
-
-        if(R>4) round2<4>(c0, c1);
-        if(R>5) round2<5>(c0, c1);
-        if(R>6) round2<6>(c0, c1);
-        if(R>7) round2<7>(c0, c1);
-        if(R>7) keymix2(c0, c1, k2, k0, 2);
-
-        if(R>8) round2<8>(c0, c1);
-        if(R>9) round2<9>(c0, c1);
-        if(R>10) round2<10>(c0, c1);
-        if(R>11) round2<11>(c0, c1);
-        if(R>11) keymix2(c0, c1, k0, k1, 3);
-        
-        if(R>12) round2<12>(c0, c1);
-        if(R>13) round2<13>(c0, c1);
-        if(R>14) round2<14>(c0, c1);
-        if(R>15) round2<15>(c0, c1);
-        if(R>15) keymix2(c0, c1, k1, k2, 4);
-
-        if(R>16) round2<16>(c0, c1);
-        if(R>17) round2<17>(c0, c1);
-        if(R>18) round2<18>(c0, c1);
-        if(R>19) round2<19>(c0, c1);
-        if(R>19) keymix2(c0, c1, k2, k0, 5);
-
-        cc0 = c0; cc1 = c1;
+    // Add the s'th subkey.  ks contains the n key words, followed by
+    // their parity, followed by the n key words again, so that the
+    // subkey's words are contiguous.
+    template <size_t s, typename Uint, size_t ... i>
+    [[gnu::always_inline]] static inline void keymix(array<Uint, n>& c, const array<Uint, 2*n+1>& ks, index_sequence<i...>){
+        ((c[slot[4*s][i]] = (c[slot[4*s][i]] + ks[(s+i)%(n+1)] + input_value_type(i==n-1 ? s : 0)) & inmask), ...);
     }
-    
-    template <unsigned r, typename Uint>
-    static void round4(Uint& c0, Uint& c1, Uint& c2, Uint& c3){
-#define SIMPLIFY_PBOX 1
-#if SIMPLIFY_PBOX
-        auto c3tmp = c3;
-        c0 = (c0+c1)&inmask; c3 = rotleft(c1,rotation_constants[r%8]); c3 ^= c0;
-        c2 = (c2+c3tmp)&inmask; c1 = rotleft(c3tmp,rotation_constants[8+r%8]); c1 ^= c2;
-#else
-        if((r&1)==0){
-            c0 = (c0+c1)&inmask; c1 = rotleft(c1,rotation_constants[r%8]); c1 ^= c0;
-            c2 = (c2+c3)&inmask; c3 = rotleft(c3,rotation_constants[8+r%8]); c3 ^= c2;
-        }else{
-            c0 = (c0+c3)&inmask; c3 = rotleft(c3,rotation_constants[r%8]); c3 ^= c0;
-            c2 = (c2+c1)&inmask; c1 = rotleft(c1,rotation_constants[8+r%8]); c1 ^= c2;
-        }
-#endif
+    // The same, for an s that's only known at run time.
+    template <typename Uint, size_t ... i>
+    [[gnu::always_inline]] static inline void keymix(array<Uint, n>& c, const array<Uint, 2*n+1>& ks, size_t s, index_sequence<i...>){
+        const size_t o = s%(n+1);
+        ((c[i] = (c[i] + ks[o+i] + input_value_type(i==n-1 ? s : 0)) & inmask), ...);
     }
 
-    template <typename Uint>
-    static void keymix4(Uint& c0, Uint& c1, Uint& c2, Uint& c3, Uint kk0, Uint kk1, Uint kk2, Uint kk3, unsigned r4){
-        c0 = (c0 + kk0) & inmask; 
-        c1 = (c1 + kk1) & inmask;
-        c2 = (c2 + kk2) & inmask;
-        c3 = (c3 + kk3 + r4) & inmask;
+    template <size_t r, typename Uint>
+    [[gnu::always_inline]] static inline void round_and_keymix(array<Uint, n>& c, const array<Uint, 2*n+1>& ks){
+        round<r>(c, make_index_sequence<n/2>{});
+        if constexpr ((r+1)%4 == 0)
+            keymix<(r+1)/4>(c, ks, make_index_sequence<n>{});
     }
 
+    template <size_t r0, typename Uint, size_t ... r>
+    [[gnu::always_inline]] static inline void rounds(array<Uint, n>& c, const array<Uint, 2*n+1>& ks, index_sequence<r...>){
+        (round_and_keymix<r0 + r>(c, ks), ...);
+    }
+
+    // Surprisingly(?), gcc (through gcc10) doesn't unroll loops over
+    // the rounds.  If we unroll them ourselves, it's about twice as
+    // fast.  But unrolling all R rounds, for every simd width, makes
+    // the 72- and 80-round wide variants take minutes to compile.  So
+    // we unroll one 8-round cycle (two key injections), with the
+    // index_sequences, and loop over the R/8 cycles.  With the
+    // default round counts of the narrow variants, there are only
+    // two cycles, and gcc peels them.  The last R%8 rounds are
+    // unrolled separately.
     template <typename Uint>
-    static void do4(Uint& cc0, Uint& cc1, Uint& cc2,  Uint& cc3, Uint k0, Uint k1, Uint k2, Uint k3){
-        auto c0 = cc0, c1 = cc1, c2 = cc2,  c3 = cc3;
-        Uint k4  = k0 ^ k1 ^ k2 ^ k3 ^ ks_parity;
-        keymix4(c0, c1, c2, c3, k0, k1, k2, k3, 0);
-
-        // Surprisingly(?), gcc (through gcc10) doesn't unroll the
-        // loop.  If we unroll it ourselves, it's about twice as fast.
-        if(R>0) round4<0>(c0, c1, c2, c3);
-        if(R>1) round4<1>(c0, c1, c2, c3);
-        if(R>2) round4<2>(c0, c1, c2, c3);
-        if(R>3) round4<3>(c0, c1, c2, c3);
-        if(R>3) keymix4(c0, c1, c2, c3, k1, k2, k3, k4, 1);
-
-        if(R>4) round4<4>(c0, c1, c2, c3);
-        if(R>5) round4<5>(c0, c1, c2, c3);
-        if(R>6) round4<6>(c0, c1, c2, c3);
-        if(R>7) round4<7>(c0, c1, c2, c3);
-        if(R>7) keymix4(c0, c1, c2, c3, k2, k3, k4, k0, 2);
-
-        if(R>8) round4<8>(c0, c1, c2, c3);
-        if(R>9) round4<9>(c0, c1, c2, c3);
-        if(R>10) round4<10>(c0, c1, c2, c3);
-        if(R>11) round4<11>(c0, c1, c2, c3);
-        if(R>11) keymix4(c0, c1, c2, c3, k3, k4, k0, k1, 3);
-        
-        if(R>12) round4<12>(c0, c1, c2, c3);
-        if(R>13) round4<13>(c0, c1, c2, c3);
-        if(R>14) round4<14>(c0, c1, c2, c3);
-        if(R>15) round4<15>(c0, c1, c2, c3);
-        if(R>15) keymix4(c0, c1, c2, c3, k4, k0, k1, k2, 4);
-
-        if(R>16) round4<16>(c0, c1, c2, c3);
-        if(R>17) round4<17>(c0, c1, c2, c3);
-        if(R>18) round4<18>(c0, c1, c2, c3);
-        if(R>19) round4<19>(c0, c1, c2, c3);
-        if(R>19) keymix4(c0, c1, c2, c3, k0, k1, k2, k3, 5);
-
-#if SIMPLIFY_PBOX
-        if(R&1){
-            cc0 = c0; cc1 = c3; cc2 = c2; cc3 = c1;
-        }else{
-            cc0 = c0; cc1 = c1; cc2 = c2; cc3 = c3;
+    [[gnu::always_inline]] static inline void threefry(array<Uint, n>& c, const array<Uint, n>& k){
+        array<Uint, 2*n+1> ks;
+        ks[n] = k[0] ^ ks_parity;
+        for(size_t i=0; i<n; ++i){
+            ks[i] = k[i];
+            ks[n+1+i] = k[i];
+            if(i)
+                ks[n] ^= k[i];
         }
-#else
-        cc0 = c0; cc1 = c1; cc2 = c2; cc3 = c3;
-#endif
+        keymix<0>(c, ks, make_index_sequence<n>{});
+        for(size_t s=0; s<R/8*2; s+=2){
+            cycle_rounds<0>(c, make_index_sequence<4>{});
+            keymix(c, ks, s+1, make_index_sequence<n>{});
+            cycle_rounds<4>(c, make_index_sequence<4>{});
+            keymix(c, ks, s+2, make_index_sequence<n>{});
+        }
+        rounds<R/8*8>(c, ks, make_index_sequence<R%8>{});
+        // N.B.  We return the variables as they are, without undoing
+        // the renaming.  All the permutations have order 4, so this
+        // is exactly Threefish when R is a multiple of 4.  Otherwise,
+        // it's a fixed reordering of Threefish's output, which
+        // matches Random123 (e.g., the threefry4x64_prf_r<13>
+        // known-answer tests).
+    }
+
+    // Rounds r0 to r0+3 of a cycle, without the key injection.
+    template <size_t r0, typename Uint, size_t ... r>
+    [[gnu::always_inline]] static inline void cycle_rounds(array<Uint, n>& c, index_sequence<r...>){
+        (round<r0 + r>(c, make_index_sequence<n/2>{}), ...);
     }
 public:
     using output_value_type = UIntType;
@@ -197,117 +259,208 @@ public:
              integral<iter_value_t<O>> &&
              indirectly_writable<O, iter_value_t<O>>
     O generate(InRange&& in, O result) const{
+        if constexpr (detail::autotuning)
+            return generate_variant<true>(prf_tuned<threefry_prf>().kernel_variant, in, result);
+        else
+            return generate_impl<true, simd_size>(in, result);
+    }
+
+    // Callers that don't care about the order of the results can get
+    // them a little faster, in the order that the simd code produces
+    // them.  The inputs are taken in groups of unordered_group_count.
+    // For each whole group, word i of the output for the s'th input in
+    // the group is written to position i*unordered_group_count + s
+    // (rather than s*n + i) relative to the start of the group's
+    // output.  The results for a final, partial group are written in
+    // the usual order.
+    template <ranges::input_range InRange, weakly_incrementable O>
+    requires ranges::sized_range<InRange> &&
+             integral<iter_value_t<ranges::range_value_t<InRange>>> &&
+             integral<iter_value_t<O>> &&
+             indirectly_writable<O, iter_value_t<O>>
+    O generate(unordered_results_t, InRange&& in, O result) const{
+        return generate_impl<false, simd_size>(in, result);
+    }
+    static constexpr size_t unordered_group_count = simd_size ? simd_N<simd_size> : 1;
+
+    // The kernel variants are the simd widths, in bytes, that generate
+    // can use:  0 (scalar), and powers of two from 16 up to
+    // PRF_SIMD_SIZE_BYTES.  They all produce the same results, but
+    // which is fastest depends on the host.  See autotune.hpp.
+    static constexpr auto kernel_variants = [](){
+        array<size_t, simd_size ? bit_width(simd_size/16) + 1 : 1> ret{};
+        for(size_t i=1; i<ret.size(); ++i)
+            ret[i] = size_t(16) << (i-1);
+        return ret;
+    }();
+    static constexpr size_t default_kernel_variant = simd_size;
+
+    template <ranges::input_range InRange, weakly_incrementable O>
+    requires ranges::sized_range<InRange> &&
+             integral<iter_value_t<ranges::range_value_t<InRange>>> &&
+             integral<iter_value_t<O>> &&
+             indirectly_writable<O, iter_value_t<O>>
+    O generate(kernel_variant v, InRange&& in, O result) const{
+        return generate_variant<true>(v.simd_bytes, in, result);
+    }
+
+    // A fused alternative to generate, for consumers that reduce the
+    // results immediately (sums, histograms, comparisons):  compute
+    // the same results, in the same order, but instead of writing
+    // them to an output iterator, call f(span<const output_value_type>)
+    // with each simd vector's worth of blocks as soon as it's computed
+    // (and with the leftovers, from a padded vector or block by block,
+    // as generate computes them).  The span points
+    // at a small local array, so once f is inlined, the values needn't
+    // leave the registers or L1.  Like std::for_each, it returns f,
+    // so a stateful f can be passed by value.
+    template <ranges::input_range InRange, typename F>
+    requires ranges::sized_range<InRange> &&
+             integral<iter_value_t<ranges::range_value_t<InRange>>> &&
+             invocable<F&, span<const output_value_type>>
+    F for_each_block(InRange&& in, F f) const{
+        detail::instrument([&](auto& ctrs){ ctrs.prf_blocks += ranges::size(in); });
         auto cp = ranges::begin(in);
         auto nleft = ranges::size(in);
-        // N.B.  simd_size=64 gives some spurious warnings about 64-byte alignment
-#if PRF_SIMD_SIZE_BYTES
-        static constexpr int simd_size = PRF_SIMD_SIZE_BYTES;
-        static constexpr size_t simd_N = simd_size/sizeof(input_value_type);
-        while(nleft>simd_N){
-            // N.B. some slots may be uninitialized, but we never use
-            // the results from those slots, so it shouldn't matter.
-            nleft -= simd_N;
-            if constexpr (n == 2){
-                input_value_type k0 __attribute__((vector_size(simd_size)));
-                input_value_type k1 __attribute__((vector_size(simd_size)));
-                input_value_type c0 __attribute__((vector_size(simd_size)));
-                input_value_type c1 __attribute__((vector_size(simd_size)));
-
-                for(unsigned s=0; s<simd_N; ++s){
-                    auto initer = *cp++;
-                    c0[s] = *initer++;
-                    c1[s] = *initer++;
-                    k0[s] = *initer++;
-                    k1[s] = *initer++;
-                }
-                do2(c0, c1, k0, k1);
-                // If we were allowed to permute the outputs and if
-                // O::value_type is the same as Uint, then we could
-                // avoid this "transpose" and copy the simd vectors
-                // directly into *result.  Would that actually speed
-                // things up?
-#if PRF_ALLOW_PERMUTED_RESULTS
-                for(unsigned s=0; s<simd_N; ++s) *result++ = c0[s];
-                for(unsigned s=0; s<simd_N; ++s) *result++ = c1[s];
-#else                
-                for(unsigned s=0; s<simd_N; ++s){
-                    *result++ = c0[s];
-                    *result++ = c1[s];
-                }
-#endif // PRF_ALLOW_PERMUTED_RESULTS
-            }else if constexpr (n == 4){
-                input_value_type k0 __attribute__((vector_size(simd_size)));
-                input_value_type k1 __attribute__((vector_size(simd_size)));
-                input_value_type k2 __attribute__((vector_size(simd_size)));
-                input_value_type k3 __attribute__((vector_size(simd_size)));
-                input_value_type c0 __attribute__((vector_size(simd_size)));
-                input_value_type c1 __attribute__((vector_size(simd_size)));
-                input_value_type c2 __attribute__((vector_size(simd_size)));
-                input_value_type c3 __attribute__((vector_size(simd_size)));
-                for(unsigned s=0; s<simd_N; ++s){
-                    auto initer = *cp++;
-                    c0[s] = *initer++;
-                    c1[s] = *initer++;
-                    c2[s] = *initer++;
-                    c3[s] = *initer++;
-                    k0[s] = *initer++;
-                    k1[s] = *initer++;
-                    k2[s] = *initer++;
-                    k3[s] = *initer++;
+        if constexpr (simd_size > 0){
+            constexpr size_t simd_N = threefry_prf::simd_N<simd_size>;
+            using simd_type = threefry_prf::simd_type<simd_size>;
+            while(nleft>=simd_N){
+                nleft -= simd_N;
+                array<simd_type, n> c;
+                array<simd_type, n> k;
+                load_vectors<simd_size>(cp, c, k);
+                threefry(c, k);
+                alignas(simd_size) output_value_type block[n*simd_N];
+                store_block<true, simd_size>(c, block);
+                f(span<const output_value_type>(block));
+            }
+            if constexpr (min_padded<simd_size> < simd_N)
+                if(nleft >= min_padded<simd_size>){
+                    alignas(simd_size) output_value_type block[n*simd_N];
+                    padded_vector<simd_size>(cp, nleft, block);
+                    f(span<const output_value_type>(block, nleft*n));
+                    return f;
                 }
-                do4(c0, c1, c2, c3, k0, k1, k2, k3);
-#if PRF_ALLOW_PERMUTED_RESULTS
-                // write results in a permuted order, one entire simd-vector at a time.
-                // Conceivably, the compiler might generate SIMD store instructions here,
-                // which might improve performance.
-                for(unsigned s=0; s<simd_N; ++s) *result++ = c0[s];
-                for(unsigned s=0; s<simd_N; ++s) *result++ = c1[s];
-                for(unsigned s=0; s<simd_N; ++s) *result++ = c2[s];
-                for(unsigned s=0; s<simd_N; ++s) *result++ = c3[s];
-#else
-                // write results in exactly the same order as the inputs.
-                for(unsigned s=0; s<simd_N; ++s){
-                    *result++ = c0[s];
-                    *result++ = c1[s];
-                    *result++ = c2[s];
-                    *result++ = c3[s];
+        }
+        while(nleft--){
+            array<input_value_type, n> c;
+            array<input_value_type, n> k;
+            load_scalars(cp, c, k);
+            threefry(c, k);
+            f(span<const output_value_type>(c));
+        }
+        return f;
+    }
+
+private:
+    static constexpr input_value_type inmask = detail::fffmask<input_value_type, input_word_size>;
+
+    // Dispatch to the kernel_variants entry equal to vb, or to the
+    // widest, if there's no such entry.
+    template <bool ordered, size_t i = 0, typename InRange, typename O>
+    O generate_variant(size_t vb, InRange&& in, O result) const{
+        if constexpr (i+1 < kernel_variants.size())
+            if(vb != kernel_variants[i])
+                return generate_variant<ordered, i+1>(vb, in, result);
+        return generate_impl<ordered, kernel_variants[i]>(in, result);
+    }
+
+    template <bool ordered, size_t vb, typename InRange, typename O>
+    O generate_impl(InRange&& in, O result) const{
+        detail::instrument([&](auto& ctrs){ ctrs.prf_blocks += ranges::size(in); });
+        auto cp = ranges::begin(in);
+        auto nleft = ranges::size(in);
+        if constexpr (vb > 0){
+            constexpr size_t simd_N = threefry_prf::simd_N<vb>;
+            using simd_type = threefry_prf::simd_type<vb>;
+            while(nleft>=simd_N){
+                nleft -= simd_N;
+                array<simd_type, n> c;
+                array<simd_type, n> k;
+                load_vectors<vb>(cp, c, k);
+                threefry(c, k);
+                // If the output is contiguous, we can write whole simd
+                // vectors directly into it.  Otherwise, write them into
+                // a small staging buffer and copy from there.
+                if constexpr (contiguous_iterator<O> &&
+                              unsigned_integral<iter_value_t<O>> &&
+                              sizeof(iter_value_t<O>) == sizeof(input_value_type)){
+                    store_block<ordered, vb>(c, to_address(result));
+                    result += n*simd_N;
+                }else{
+                    alignas(vb) input_value_type staging[n*simd_N];
+                    store_block<ordered, vb>(c, staging);
+                    for(auto v : staging)
+                        *result++ = v;
                 }
-#endif // PRF_ALLOW_PERMUTED_RESULTS
             }
+            if constexpr (min_padded<vb> < simd_N)
+                if(nleft >= min_padded<vb>)
+                    return padded_vector<vb>(cp, nleft, result);
         }
-#endif // PRF_SIMD_SIZE_BYTES
 
+        return generate_scalar(cp, nleft, result);
+    }
+    template <typename I, typename O>
+    static O generate_scalar(I cp, size_t nleft, O result){
         while(nleft--){
-            auto initer = *cp++;
-            if constexpr (n == 2){
-                input_value_type c0 = *initer++ ;
-                input_value_type c1 = *initer++;
-                input_value_type k0 = *initer++;
-                input_value_type k1 = *initer++;
-                do2(c0, c1, k0, k1);
-                *result++ = c0;
-                *result++ = c1;
-            }else if constexpr (n == 4){
-                input_value_type c0 = *initer++;
-                input_value_type c1 = *initer++;
-                input_value_type c2 = *initer++;
-                input_value_type c3 = *initer++;
-                input_value_type k0 = *initer++;
-                input_value_type k1 = *initer++;
-                input_value_type k2 = *initer++;
-                input_value_type k3 = *initer++;
-                do4(c0, c1, c2, c3, k0, k1, k2, k3);
-                *result++ = c0;
-                *result++ = c1;
-                *result++ = c2;
-                *result++ = c3;
-            }
+            array<input_value_type, n> c;
+            array<input_value_type, n> k;
+            load_scalars(cp, c, k);
+            threefry(c, k);
+            for(size_t i=0; i<n; ++i)
+                *result++ = c[i];
         }
         return result;
     }
 
-private:
-    static constexpr input_value_type inmask = detail::fffmask<input_value_type, input_word_size>;
+    // Fill the lanes of c and k from the next simd_N<vb> inputs.
+    // gcc doesn't understand that filling every lane of a simd
+    // vector, one at a time, initializes it, and value-initializing
+    // c and k doesn't convince it, so the warnings are off for these
+    // stores only.
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+#pragma GCC diagnostic ignored "-Wuninitialized"
+    template <size_t vb, typename I>
+    [[gnu::always_inline]] static inline void load_vectors(I& cp, array<simd_type<vb>, n>& c, array<simd_type<vb>, n>& k){
+        for(unsigned s=0; s<simd_N<vb>; ++s){
+            auto initer = *cp++;
+            for(size_t i=0; i<n; ++i)
+                c[i][s] = *initer++;
+            for(size_t i=0; i<n; ++i)
+                k[i][s] = *initer++;
+        }
+    }
+#pragma GCC diagnostic pop
+    // The ordered results of the last m < simd_N<vb> inputs, at cp,
+    // computed in one zero-padded vector and written to result.  It's
+    // out of line so that it doesn't crowd the main loops.
+    template <size_t vb, typename I, typename O>
+    [[gnu::noinline]] static O padded_vector(I cp, size_t m, O result){
+        array<simd_type<vb>, n> c{};
+        array<simd_type<vb>, n> k{};
+        for(unsigned s=0; s<m; ++s){
+            auto initer = *cp++;
+            for(size_t i=0; i<n; ++i)
+                c[i][s] = *initer++;
+            for(size_t i=0; i<n; ++i)
+                k[i][s] = *initer++;
+        }
+        threefry(c, k);
+        alignas(vb) input_value_type staging[n*simd_N<vb>];
+        store_block<true, vb>(c, staging);
+        return ranges::copy_n(staging, m*n, result).out;
+    }
+    template <typename I>
+    [[gnu::always_inline]] static inline void load_scalars(I& cp, array<input_value_type, n>& c, array<input_value_type, n>& k){
+        auto initer = *cp++;
+        for(size_t i=0; i<n; ++i)
+            c[i] = *initer++;
+        for(size_t i=0; i<n; ++i)
+            k[i] = *initer++;
+    }
 };
 
 // These constants are carefully chosen to achieve good randomization.  
@@ -333,10 +486,35 @@ template<size_t r>
 using threefry4x64_prf_r = threefry_prf<uint_least64_t, 64, 4, r, 0x1BD11BDAA9FC1A22,
                                              14, 52, 23, 5, 25, 46, 58, 32,
                                              16, 57, 40, 37, 33, 12, 22, 32>;
+
+// The 8- and 16-word variants use the rotation constants of
+// Threefish-512 and Threefish-1024.  With r=72 and r=80, respectively,
+// they are exactly Threefish with a zero tweak.
+template<size_t r>
+using threefry8x64_prf_r = threefry_prf<uint_least64_t, 64, 8, r, 0x1BD11BDAA9FC1A22,
+                                             46, 33, 17, 44, 39, 13, 25,  8,
+                                             36, 27, 49,  9, 30, 50, 29, 35,
+                                             19, 14, 36, 54, 34, 10, 39, 56,
+                                             37, 42, 39, 56, 24, 17, 43, 22>;
+
+template<size_t r>
+using threefry16x64_prf_r = threefry_prf<uint_least64_t, 64, 16, r, 0x1BD11BDAA9FC1A22,
+                                             24, 38, 33,  5, 41, 16, 31,  9,
+                                             13, 19,  4, 20,  9, 34, 44, 48,
+                                              8, 10, 51, 48, 37, 56, 47, 35,
+                                             47, 55, 13, 41, 31, 51, 46, 52,
+                                              8, 49, 34, 47, 12,  4, 19, 23,
+                                             17, 18, 41, 28, 47, 53, 42, 31,
+                                             22, 23, 59, 16, 44, 42, 44, 37,
+                                             37, 52, 17, 25, 30, 41, 25, 20>;
 using threefry2x32_prf = threefry2x32_prf_r<20>;
 using threefry2x64_prf = threefry2x64_prf_r<20>;
 using threefry4x32_prf = threefry4x32_prf_r<20>;
 using threefry4x64_prf = threefry4x64_prf_r<20>;
+// There are no Crush-resistance results for the wider variants, so
+// their defaults are Threefish's own (full-strength) round counts.
+using threefry8x64_prf = threefry8x64_prf_r<72>;
+using threefry16x64_prf = threefry16x64_prf_r<80>;
 
 } // namespace std
 
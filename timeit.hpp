@@ -21,6 +21,23 @@
 // You can pass any no-argument functor at all to timeit: a plain-old
 // function, a class with an operator()(), or a lambda (as above).
 //
+// Hardware counters:  timeit(dur, func, hw) also reports what the
+// hw_counters object, hw, measured while func was running, in
+// result.hw.  On Linux, hw_counters uses perf_event_open to count
+// this thread's cycles, instructions and last-level cache misses.  If
+// the environment variable TIMEIT_VECTOR_EVENT is set to a raw,
+// model-specific event code (hex, as for 'perf stat -e rNNNN'), it
+// is counted too, e.g., as a measure of vector-unit usage.  If
+// perf_event_open isn't available (e.g., in a VM or container, or
+// because of /proc/sys/kernel/perf_event_paranoid), cycles come from
+// rdtsc instead.  Those are reference cycles, and they include
+// whatever else the core was doing, and the other counters are
+// reported as -1.
+//
+//   hw_counters hw;   // open the counters once, and reuse them
+//   auto result = timeit(std::chrono::seconds(1), func, hw);
+//   std::cout << result.hw.ipc() << " instructions per cycle\n";
+//
 // Note that if f() has no side-effects, it's *possible* for an
 // aggressive optimizer to completely elide calls to it, resulting in
 // timings that are not representative.
@@ -29,6 +46,18 @@
 #include <atomic>
 #include <chrono>
 #include <thread>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#if defined(__linux__)
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
 
 // N.b. use the high_resolution_clock, even though it might not be
 // 'steady'.  Timeit is typically used for short timing runs
@@ -36,9 +65,103 @@
 // worried about the clock's steadiness.
 using clk_t = std::chrono::high_resolution_clock;
 
+// What a hw_counters object counted.  -1 means 'not available'.
+struct hw_counts{
+    long long cycles = -1;
+    long long instructions = -1;
+    long long cache_misses = -1;
+    long long vector_events = -1;
+    bool cycles_from_tsc = false;
+    double ipc() const { return (cycles > 0 && instructions >= 0) ? double(instructions)/cycles : -1.; }
+};
+
+class hw_counters{
+    enum { CYCLES, INSTRUCTIONS, CACHE_MISSES, VECTOR, NFD };
+    int fds[NFD] = {-1, -1, -1, -1};
+    unsigned long long tsc0 = 0;
+
+#if defined(__linux__)
+    static int open_event(uint32_t type, uint64_t config){
+        perf_event_attr attr;
+        std::memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = type;
+        attr.config = config;
+        attr.disabled = 1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        return syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+    }
+#endif
+    static unsigned long long tsc(){
+#if defined(__x86_64__) || defined(__i386__)
+        return __rdtsc();
+#else
+        return 0;
+#endif
+    }
+
+public:
+    hw_counters(){
+#if defined(__linux__)
+        fds[CYCLES] = open_event(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES);
+        if(fds[CYCLES] < 0)
+            return;
+        fds[INSTRUCTIONS] = open_event(PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS);
+        fds[CACHE_MISSES] = open_event(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES);
+        if(auto ve = std::getenv("TIMEIT_VECTOR_EVENT"))
+            fds[VECTOR] = open_event(PERF_TYPE_RAW, std::strtoull(ve, nullptr, 16));
+#endif
+    }
+    ~hw_counters(){
+#if defined(__linux__)
+        for(auto fd : fds)
+            if(fd >= 0)
+                close(fd);
+#endif
+    }
+    hw_counters(const hw_counters&) = delete;
+    hw_counters& operator=(const hw_counters&) = delete;
+
+    // True if the counts come from perf_event_open, false if from rdtsc.
+    bool perf_available() const { return fds[CYCLES] >= 0; }
+
+    void start(){
+#if defined(__linux__)
+        for(auto fd : fds)
+            if(fd >= 0){
+                ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+                ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+            }
+#endif
+        tsc0 = tsc();
+    }
+    hw_counts stop(){
+        auto tsc1 = tsc();
+        hw_counts ret;
+#if defined(__linux__)
+        long long* dest[NFD] = {&ret.cycles, &ret.instructions, &ret.cache_misses, &ret.vector_events};
+        for(int i=0; i<NFD; ++i){
+            if(fds[i] < 0)
+                continue;
+            ioctl(fds[i], PERF_EVENT_IOC_DISABLE, 0);
+            long long v;
+            if(read(fds[i], &v, sizeof(v)) == sizeof(v))
+                *dest[i] = v;
+        }
+#endif
+        if(ret.cycles < 0 && tsc1){
+            ret.cycles = tsc1 - tsc0;
+            ret.cycles_from_tsc = true;
+        }
+        return ret;
+    }
+};
+
 struct timeit_result{
     long long count;
     clk_t::duration dur;
+    hw_counts hw;   // only filled in by timeit(dur, f, hw_counters&)
     timeit_result(long long count_, const clk_t::duration& dur_):
         count(count_), dur(dur_)
     {}
@@ -49,7 +172,7 @@ struct timeit_result{
 
 template <class Rep, class Period, class Functor>
 timeit_result
-timeit(const std::chrono::duration<Rep, Period>& dur, Functor f){
+timeit(const std::chrono::duration<Rep, Period>& dur, Functor f, hw_counters* hw = nullptr){
     std::atomic<bool> done(false);
     std::thread t( [&](){
             std::this_thread::sleep_for(dur);
@@ -57,6 +180,8 @@ timeit(const std::chrono::duration<Rep, Period>& dur, Functor f){
         });
     
     long long n = 0;
+    if(hw)
+        hw->start();
     auto start = clk_t::now();
     do{
         // Unrolling this produced very confusing results.  Any f()
@@ -70,6 +195,15 @@ timeit(const std::chrono::duration<Rep, Period>& dur, Functor f){
         n++;
     }while(!done.load());
     auto elapsed = clk_t::now() - start;
+    timeit_result ret(n, elapsed);
+    if(hw)
+        ret.hw = hw->stop();
     t.join();
-    return {n, elapsed};
+    return ret;
+}
+
+template <class Rep, class Period, class Functor>
+timeit_result
+timeit(const std::chrono::duration<Rep, Period>& dur, Functor f, hw_counters& hw){
+    return timeit(dur, f, &hw);
 }